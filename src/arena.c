@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ALIGN_UP(n)         (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define BLOCK_DATA(b)       ((char *)(b) + ALIGN_UP(sizeof(block_t)))
+
+void arena_init(arena_t *arena)
+{
+    arena->blocks = NULL;
+    arena->last = NULL;
+}
+
+void arena_free(arena_t *arena)
+{
+    block_t *block = arena->blocks;
+
+    while (block != NULL) {
+        block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    arena_init(arena);
+}
+
+static block_t *newBlock(size_t capacity)
+{
+    block_t *block = malloc(ALIGN_UP(sizeof(block_t)) + capacity);
+    if (block == NULL) return NULL;
+
+    block->size = capacity;
+    block->used = 0;
+    return block;
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    block_t *block = arena->blocks;
+    size = ALIGN_UP(size);
+
+    if (block != NULL && block->used + size > block->size && size > ARENA_BLOCK_SIZE / 4) {
+        // A large request gets a block of its own behind the current one,
+        // which keeps its room for the small ones.
+        block_t *own = newBlock(size);
+        if (own == NULL) return NULL;
+
+        own->used = size;
+        own->next = block->next;
+        block->next = own;
+        return BLOCK_DATA(own);
+    }
+
+    if (block == NULL || block->used + size > block->size) {
+        block = newBlock(size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+        if (block == NULL) return NULL;
+
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    void *ptr = BLOCK_DATA(block) + block->used;
+    block->used += size;
+
+    arena->last = ptr;
+    return ptr;
+}
+
+void *arena_grow(arena_t *arena, void *ptr, size_t old, size_t new)
+{
+    if (ptr == NULL) return arena_alloc(arena, new);
+
+    block_t *block = arena->blocks;
+
+    // Extend in place when the pointer is the tail of the current block.
+    if (ptr == arena->last) {
+        size_t start = (char *)ptr - BLOCK_DATA(block);
+        if (start + ALIGN_UP(new) <= block->size) {
+            block->used = start + ALIGN_UP(new);
+            return ptr;
+        }
+    }
+
+    void *grown = arena_alloc(arena, new);
+    if (grown == NULL) return NULL;
+
+    memcpy(grown, ptr, old < new ? old : new);
+    return grown;
+}
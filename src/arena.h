@@ -0,0 +1,25 @@
+#pragma once
+
+#include "common.h"
+
+#define ARENA_BLOCK_SIZE    (16 * 1024)
+#define ARENA_ALIGN         8
+
+typedef struct _block block_t;
+
+struct _block {
+    block_t *next;
+    size_t size;
+    size_t used;
+};
+
+typedef struct {
+    block_t *blocks;
+    void *last;         // Latest allocation in the first block, it can grow in place.
+} arena_t;
+
+void arena_init(arena_t *arena);
+void arena_free(arena_t *arena);
+
+void *arena_alloc(arena_t *arena, size_t size);
+void *arena_grow(arena_t *arena, void *ptr, size_t old, size_t new);
@@ -0,0 +1,254 @@
+#include "channel.h"
+#include "vm.h"
+#include "gc.h"
+
+// Blocked threads wake up this often to notice a cancel.
+#define WAIT_SLICE_MS   10
+
+// Where this thread's next select starts looking, so that one busy
+// channel doesn't starve the others.
+static THREAD_LOCAL unsigned turn;
+
+channel_t *channel_new(vm_t *vm, int capacity)
+{
+    int size = 2;
+    while (size < capacity && size < CHANNEL_MAX) size *= 2;
+
+    channel_t *channel = (channel_t *)obj_alloc(vm, CHANNEL_SIZE(size), OT_CHANNEL);
+    channel->capacity = size;
+    atomic_init(&channel->closed, false);
+
+    mutex_init(&channel->lock);
+    channel->waiters = NULL;
+    atomic_init(&channel->waiting, 0);
+
+    atomic_init(&channel->sent, 0);
+    atomic_init(&channel->received, 0);
+    for (int i = 0; i < size; i++) {
+        atomic_init(&channel->cells[i].sequence, (size_t)i);
+        channel->cells[i].value = VAL_NIL;
+    }
+    return channel;
+}
+
+static bool push(channel_t *channel, val_t value)
+{
+    size_t mask = (size_t)channel->capacity - 1;
+    size_t position = atomic_load_explicit(&channel->sent, memory_order_relaxed);
+    cell_t *cell;
+
+    for (;;) {
+        cell = &channel->cells[position & mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&channel->sent, &position, position + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            return false;   // The receiver of a lap ago is not done yet, full.
+        }
+        else {
+            position = atomic_load_explicit(&channel->sent, memory_order_relaxed);
+        }
+    }
+
+    cell->value = value;
+    atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+    return true;
+}
+
+static bool pop(channel_t *channel, val_t *value)
+{
+    size_t mask = (size_t)channel->capacity - 1;
+    size_t position = atomic_load_explicit(&channel->received, memory_order_relaxed);
+    cell_t *cell;
+
+    for (;;) {
+        cell = &channel->cells[position & mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(position + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&channel->received, &position, position + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            return false;   // Nothing sent there yet, empty.
+        }
+        else {
+            position = atomic_load_explicit(&channel->received, memory_order_relaxed);
+        }
+    }
+
+    *value = cell->value;
+    atomic_store_explicit(&cell->sequence, position + mask + 1, memory_order_release);
+    return true;
+}
+
+static void wake(waiter_t *waiter)
+{
+    mutex_lock(&waiter->lock);
+    waiter->woken = true;
+    cond_signal(&waiter->wake);
+    mutex_unlock(&waiter->lock);
+}
+
+// After a send, a receive or a close, for whoever waits on either side.
+static void notify(channel_t *channel)
+{
+    // Orders the change before the check, a waiter counts itself before
+    // it tries again.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&channel->waiting, memory_order_relaxed) == 0) return;
+
+    mutex_lock(&channel->lock);
+    for (wait_t *wait = channel->waiters; wait != NULL; wait = wait->next) {
+        wake(wait->waiter);
+    }
+    mutex_unlock(&channel->lock);
+}
+
+// Registers the waiter with each channel. The caller tries once more
+// afterwards, a change from then on wakes it.
+static void beginWait(waiter_t *waiter, channel_t **channels, wait_t *waits, int count)
+{
+    mutex_init(&waiter->lock);
+    cond_init(&waiter->wake);
+    waiter->woken = false;
+
+    for (int i = 0; i < count; i++) {
+        channel_t *channel = channels[i];
+        waits[i].waiter = waiter;
+
+        mutex_lock(&channel->lock);
+        waits[i].next = channel->waiters;
+        channel->waiters = &waits[i];
+        mutex_unlock(&channel->lock);
+
+        atomic_fetch_add(&channel->waiting, 1);
+    }
+
+    // Pairs with the fence in notify, one side sees the other.
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+static void endWait(waiter_t *waiter, channel_t **channels, wait_t *waits, int count)
+{
+    for (int i = 0; i < count; i++) {
+        channel_t *channel = channels[i];
+
+        mutex_lock(&channel->lock);
+        wait_t **link = &channel->waiters;
+        while (*link != &waits[i]) link = &(*link)->next;
+        *link = waits[i].next;
+        mutex_unlock(&channel->lock);
+
+        atomic_fetch_sub(&channel->waiting, 1);
+    }
+
+    mutex_destroy(&waiter->lock);
+    cond_destroy(&waiter->wake);
+}
+
+// Out of the heap while blocked, the channels and values are safe in the
+// arguments.
+static void waitFor(vm_t *vm, waiter_t *waiter)
+{
+    gc_leave(vm->gc);
+    mutex_lock(&waiter->lock);
+
+    if (!waiter->woken) cond_timedwait(&waiter->wake, &waiter->lock, WAIT_SLICE_MS);
+    waiter->woken = false;
+
+    mutex_unlock(&waiter->lock);
+    gc_enter(vm->gc, vm);
+}
+
+// A send racing a close may still get its value in.
+void channel_close(channel_t *channel)
+{
+    atomic_store(&channel->closed, true);
+    notify(channel);
+}
+
+bool channel_trysend(channel_t *channel, val_t value)
+{
+    if (atomic_load(&channel->closed) || !push(channel, value)) return false;
+
+    notify(channel);
+    return true;
+}
+
+bool channel_tryrecv(channel_t *channel, val_t *value)
+{
+    if (!pop(channel, value)) return false;
+
+    notify(channel);
+    return true;
+}
+
+bool channel_send(vm_t *vm, channel_t *channel, val_t value)
+{
+    if (channel_trysend(channel, value)) return true;
+
+    waiter_t waiter;
+    wait_t wait;
+    beginWait(&waiter, &channel, &wait, 1);
+
+    bool sent;
+    while (!(sent = channel_trysend(channel, value))) {
+        if (atomic_load(&channel->closed) || atomic_load(&vm->halt)) break;
+        waitFor(vm, &waiter);
+    }
+
+    endWait(&waiter, &channel, &wait, 1);
+    return sent;
+}
+
+// Tries each channel once. The closed flag is read before trying, so
+// that values sent before a close are all received.
+static int tryAll(channel_t **channels, int count, val_t *value, bool *open)
+{
+    unsigned start = turn++;
+    *open = false;
+
+    for (int i = 0; i < count; i++) {
+        int index = (int)((start + (unsigned)i) % (unsigned)count);
+        bool closed = atomic_load(&channels[index]->closed);
+
+        if (channel_tryrecv(channels[index], value)) return index;
+        if (!closed) *open = true;
+    }
+
+    return -1;
+}
+
+int channel_select(vm_t *vm, channel_t **channels, int count, bool block, val_t *value)
+{
+    bool open;
+    int index = tryAll(channels, count, value, &open);
+    if (index >= 0 || !open || !block) return index;
+
+    waiter_t waiter;
+    wait_t waits[CHANNEL_SELECT_MAX];
+    beginWait(&waiter, channels, waits, count);
+
+    while ((index = tryAll(channels, count, value, &open)) < 0) {
+        if (!open || atomic_load(&vm->halt)) break;
+        waitFor(vm, &waiter);
+    }
+
+    endWait(&waiter, channels, waits, count);
+    return index;
+}
+
+bool channel_recv(vm_t *vm, channel_t *channel, val_t *value)
+{
+    return channel_select(vm, &channel, 1, true, value) == 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdatomic.h>
+
+#include "common.h"
+#include "value.h"
+#include "object.h"
+#include "sync.h"
+
+// A bounded queue of values between threads, the ring buffer of Vyukov.
+// Each cell carries a sequence number saying whose turn it is, so that
+// senders and receivers only race on a counter of their own side and
+// take no lock. A thread takes the channel's lock only to wait.
+//
+// Values pass by reference, the heap is shared. Numbers, strings and
+// pmaps can't change and go as they are, maps and the other values that
+// belong to one thread can't be sent.
+
+#define CHANNEL_MAX     (1 << 20)
+#define CHANNEL_SELECT_MAX 64
+#define CHANNEL_LINE    64      // Keeps the two counters off each other's cache line.
+
+// A thread blocked on one or more channels, woken by any of them.
+typedef struct {
+    mutex_t lock;
+    cond_t wake;
+    bool woken;
+} waiter_t;
+
+// A waiter's place in the list of one channel.
+typedef struct _wait {
+    waiter_t *waiter;
+    struct _wait *next;
+} wait_t;
+
+typedef struct {
+    atomic_size_t sequence;     // Its position when free, one past when full.
+    val_t value;
+} cell_t;
+
+struct _channel {
+    obj_t obj;
+    int capacity;               // A power of two.
+    atomic_bool closed;
+
+    mutex_t lock;               // Guards the waiters.
+    wait_t *waiters;
+    atomic_int waiting;
+
+    char pad[CHANNEL_LINE];
+    atomic_size_t sent;         // Cells claimed by senders so far.
+    char pad2[CHANNEL_LINE - sizeof(atomic_size_t)];
+    atomic_size_t received;     // Cells claimed by receivers so far.
+    char pad3[CHANNEL_LINE - sizeof(atomic_size_t)];
+
+    cell_t cells[];
+};
+
+#define CHANNEL_SIZE(n) (sizeof(channel_t) + (size_t)(n) * sizeof(cell_t))
+
+// The capacity is rounded up to a power of two, at least 2.
+channel_t *channel_new(vm_t *vm, int capacity);
+void channel_close(channel_t *channel);
+
+// Fail at once when full, empty or closed.
+bool channel_trysend(channel_t *channel, val_t value);
+bool channel_tryrecv(channel_t *channel, val_t *value);
+
+// Wait for room or a value, false once the channel is closed and
+// drained or the VM is halted.
+bool channel_send(vm_t *vm, channel_t *channel, val_t value);
+bool channel_recv(vm_t *vm, channel_t *channel, val_t *value);
+
+// Receives from whichever channel has a value first and returns its
+// index, -1 when all are closed and drained, when the VM is halted or,
+// without block, when none has a value. At most CHANNEL_SELECT_MAX.
+int channel_select(vm_t *vm, channel_t **channels, int count, bool block, val_t *value);
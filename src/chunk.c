@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "chunk.h"
 
@@ -10,25 +11,40 @@ void chunk_init(chunk_t *chunk, src_t *source)
     chunk->code = NULL;
     chunk->lines = NULL;
     chunk->source = source;
+    chunk->arena = NULL;
 
     arr_init(&chunk->constants);
 }
 
 void chunk_free(chunk_t *chunk)
 {
-    free(chunk->code);
-    free(chunk->lines);
+    // Storage of an unfinished chunk belongs to the compiler's arena.
+    if (chunk->arena == NULL) {
+        free(chunk->code);
+        free(chunk->lines);
+        arr_free(&chunk->constants);
+    }
 
-    arr_free(&chunk->constants);
     chunk_init(chunk, NULL);
 }
 
+static void *growArray(chunk_t *chunk, void *array, size_t old, size_t new)
+{
+    if (chunk->arena != NULL)
+        return arena_grow(chunk->arena, array, old, new);
+
+    return realloc(array, new);
+}
+
 void chunk_emit(chunk_t *chunk, uint8_t byte, int ln, int col)
 {
     if (chunk->count >= chunk->capacity) {
-        chunk->capacity += CHUNK_CODEPAGE;
-        chunk->code = realloc(chunk->code, chunk->capacity * sizeof(uint8_t));
-        chunk->lines = realloc(chunk->lines, chunk->capacity * sizeof(uint32_t));
+        int old = chunk->capacity;
+        chunk->capacity = old < CHUNK_CODEPAGE ? CHUNK_CODEPAGE : old * 2;
+        chunk->code = growArray(chunk, chunk->code,
+            old * sizeof(uint8_t), chunk->capacity * sizeof(uint8_t));
+        chunk->lines = growArray(chunk, chunk->lines,
+            old * sizeof(uint32_t), chunk->capacity * sizeof(uint32_t));
     }
 
     uint32_t line = ((ln & 0xFFFF) << 16) | (col & 0xFFFF);
@@ -36,3 +52,47 @@ void chunk_emit(chunk_t *chunk, uint8_t byte, int ln, int col)
     chunk->lines[chunk->count] = line;
     chunk->count++;
 }
+
+int chunk_const(chunk_t *chunk, val_t value)
+{
+    arr_t *constants = &chunk->constants;
+
+    for (int i = 0; i < constants->count; i++)
+        if (val_equal(constants->values[i], value))
+            return i;
+
+    if (constants->count >= constants->capacity) {
+        int old = constants->capacity;
+        constants->capacity = GROW_CAPACITY(old);
+        constants->values = growArray(chunk, constants->values,
+            old * sizeof(val_t), constants->capacity * sizeof(val_t));
+    }
+
+    constants->values[constants->count] = value;
+    return constants->count++;
+}
+
+static void *copyExact(const void *array, size_t size)
+{
+    if (size == 0) return NULL;
+
+    void *exact = malloc(size);
+    memcpy(exact, array, size);
+    return exact;
+}
+
+void chunk_finalize(chunk_t *chunk)
+{
+    if (chunk->arena == NULL) return;
+
+    arr_t *constants = &chunk->constants;
+
+    chunk->code = copyExact(chunk->code, chunk->count * sizeof(uint8_t));
+    chunk->lines = copyExact(chunk->lines, chunk->count * sizeof(uint32_t));
+    chunk->capacity = chunk->count;
+
+    constants->values = copyExact(constants->values, constants->count * sizeof(val_t));
+    constants->capacity = constants->count;
+
+    chunk->arena = NULL;
+}
@@ -2,6 +2,7 @@
 
 #include "common.h"
 #include "value.h"
+#include "arena.h"
 
 #define OPCODES() \
 /*        opcodes      args     stack       description */ \
@@ -29,7 +30,9 @@
     _CODE(JMPF)    	/* [s, s]   [-1, +0]    */ \
     _CODE(LD)      	/* [s]      [-0, +1]    */ \
     _CODE(ST)      	/* [s]      [-0, +0]    */ \
-    _CODE(MAP)      /* []       [-0, +1]    */ \
+    _CODE(MAP)      /* [s, s]   [-0, +1]    push a new map with room for (s) elements */ \
+    _CODE(MAPK)     /* [k, s, s][-0, +1]    push a copy of the map (k) with room for (s) elements */ \
+    _CODE(FILL)     /* [s, s, n][-n, +0]    pop (n) elements into the map below them from index (s) */ \
     _CODE(GET)      \
     _CODE(SET)      \
     _CODE(GETI)     \
@@ -46,11 +49,14 @@ typedef struct {
     uint32_t *lines;
     src_t *source;
     arr_t constants;
+    arena_t *arena;     // Set while the chunk is being compiled.
 } chunk_t;
 
 void chunk_init(chunk_t *chunk, src_t *source);
 void chunk_free(chunk_t *chunk);
 void chunk_emit(chunk_t *chunk, uint8_t byte, int ln, int col);
+int chunk_const(chunk_t *chunk, val_t value);
+void chunk_finalize(chunk_t *chunk);
 
 #define CHUNK_CODEPAGE      256
 #define CHUNK_GETLN(c, i)   (((c)->lines)[i] >> 16 & 0xFFFF)
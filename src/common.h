@@ -8,6 +8,10 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #define UINT8_COUNT         (UINT8_MAX + 1)
 
 #define CMB_BYTES(l, r)	    (uint8_t)(((char)(l) & 0xF) | ((char)(r) & 0xF) << 4)
@@ -23,14 +27,27 @@
 #define VM_OK               0
 #define VM_COMPILE_ERROR    1
 #define VM_RUNTIME_ERROR    2
+#define VM_HALTED           3
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL        __declspec(thread)
+#else
+#define THREAD_LOCAL        _Thread_local
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAS_SSE2
+#endif
 
 #define DEBUG_PRINT_CODE
+//#define DEBUG_STRESS_GC
 
 typedef struct _val val_t;
 typedef struct _vm  vm_t;
 typedef struct _gc  gc_t;
 
 typedef val_t (* cfn_t)(vm_t *vm, int argc, val_t *args);
+typedef void (* pfn_t)(vm_t *vm, void *data);
 
 typedef struct {
     char *buffer;
@@ -38,8 +55,33 @@ typedef struct {
     size_t size;
 } src_t;
 
+bool bytes_ascii(const char *chars, size_t size);
 uint32_t hash_bytes(const void *bytes, size_t size);
+uint64_t hash_wide(const void *bytes, size_t size, uint64_t seed);
+void hash_seed(uint64_t seed);
 char *read_file(const char *path, size_t *size);
 
+// Index of the lowest set bit, mask must not be zero.
+static inline int bit_first(uint32_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Number of set bits.
+static inline int bit_count(uint32_t mask)
+{
+#ifdef _MSC_VER
+    return (int)__popcnt(mask);
+#else
+    return __builtin_popcount(mask);
+#endif
+}
+
 src_t *src_new(const char *fname);
 void src_free(src_t *source);
@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dict.h"
+#include "hash.h"
+#include "object.h"
+#include "gc.h"
+
+#define INDEX_EMPTY     (-1)
+#define INDEX_REMOVED   (-2)
+
+void dict_init(dict_t *dict, gc_t *gc)
+{
+    dict->count = 0;
+    dict->used = 0;
+    dict->capacity = 0;
+    dict->entries = NULL;
+    dict->indexes = NULL;
+    dict->gc = gc;
+}
+
+void dict_free(dict_t *dict)
+{
+    gc_realloc(dict->gc, dict->entries, DICT_SIZE(dict->capacity), 0);
+    dict_init(dict, dict->gc);
+}
+
+static inline int getIndex(void *indexes, int capacity, uint32_t slot)
+{
+    switch (DICT_WIDTH(capacity)) {
+        case 1: return ((int8_t *)indexes)[slot];
+        case 2: return ((int16_t *)indexes)[slot];
+        default: return ((int32_t *)indexes)[slot];
+    }
+}
+
+static inline void setIndex(void *indexes, int capacity, uint32_t slot, int index)
+{
+    switch (DICT_WIDTH(capacity)) {
+        case 1: ((int8_t *)indexes)[slot] = (int8_t)index; break;
+        case 2: ((int16_t *)indexes)[slot] = (int16_t)index; break;
+        default: ((int32_t *)indexes)[slot] = (int32_t)index; break;
+    }
+}
+
+// Numbers are stored normalized, strings by their pointer.
+static inline uint64_t keyBits(val_t key)
+{
+    return IS_NUM(key) ? hash_normalize(key.raw) : key.raw;
+}
+
+static inline uint32_t keyHash(val_t key, uint64_t bits)
+{
+    return IS_NUM(key) ? (uint32_t)hash_mix(bits) : AS_STR(key)->hash;
+}
+
+// The probe sequence of CPython, the higher bits of the hash join in
+// bit by bit so keys that share their low bits part ways.
+#define NEXT_SLOT(slot, perturb, mask) \
+    ((perturb) >>= 5, (slot) = ((slot) * 5 + (perturb) + 1) & (mask))
+
+static int findSlot(dict_t *dict, uint64_t bits, uint32_t type, uint32_t hash)
+{
+    uint32_t mask = dict->capacity - 1;
+    uint32_t slot = hash & mask;
+
+    for (uint32_t perturb = hash;; NEXT_SLOT(slot, perturb, mask)) {
+        int index = getIndex(dict->indexes, dict->capacity, slot);
+        if (index == INDEX_EMPTY) return -1;
+        if (index < 0) continue;
+
+        entry_t *entry = &dict->entries[index];
+        if (entry->key == bits && entry->keyType == type) return (int)slot;
+    }
+}
+
+static uint32_t emptySlot(void *indexes, int capacity, uint32_t hash)
+{
+    uint32_t mask = capacity - 1;
+    uint32_t slot = hash & mask;
+
+    for (uint32_t perturb = hash;; NEXT_SLOT(slot, perturb, mask)) {
+        if (getIndex(indexes, capacity, slot) == INDEX_EMPTY) return slot;
+    }
+}
+
+// Copies the live entries in order, which drops the removed ones.
+static bool resize(dict_t *dict, int capacity)
+{
+    entry_t *entries = ALLOC(dict->gc, DICT_SIZE(capacity));
+    if (entries == NULL) return false;
+
+    void *indexes = entries + DICT_USABLE(capacity);
+    memset(indexes, 0xFF, (size_t)capacity * DICT_WIDTH(capacity));
+
+    int count = 0;
+    for (int i = 0; i < dict->used; i++) {
+        entry_t *entry = &dict->entries[i];
+        if (entry->keyType == VT_NIL) continue;
+
+        uint32_t slot = emptySlot(indexes, capacity, entry->hash);
+        setIndex(indexes, capacity, slot, count);
+        entries[count++] = *entry;
+    }
+
+    gc_realloc(dict->gc, dict->entries, DICT_SIZE(dict->capacity), 0);
+    dict->entries = entries;
+    dict->indexes = indexes;
+    dict->capacity = capacity;
+    dict->used = count;
+    return true;
+}
+
+// The smallest capacity with room for count entries.
+static int fitCapacity(int count)
+{
+    int capacity = DICT_MIN;
+    while (DICT_USABLE(capacity) < count) capacity *= 2;
+    return capacity;
+}
+
+bool dict_get(dict_t *dict, val_t key, val_t *value)
+{
+    if (dict->count == 0) return false;
+
+    uint64_t bits = keyBits(key);
+    int slot = findSlot(dict, bits, key.type, keyHash(key, bits));
+    if (slot < 0) return false;
+
+    *value = dict_value(&dict->entries[getIndex(dict->indexes, dict->capacity, slot)]);
+    return true;
+}
+
+bool dict_set(dict_t *dict, val_t key, val_t value)
+{
+    uint64_t bits = keyBits(key);
+    uint32_t hash = keyHash(key, bits);
+
+    if (dict->count > 0) {
+        int slot = findSlot(dict, bits, key.type, hash);
+        if (slot >= 0) {
+            entry_t *entry = &dict->entries[getIndex(dict->indexes, dict->capacity, slot)];
+            entry->value = value.raw;
+            entry->valueType = (uint8_t)value.type;
+            return false;
+        }
+    }
+
+    if (dict_full(dict)) {
+        // Room for half as many keys again, which is no growth at all
+        // when removed entries were most of the array.
+        int capacity = fitCapacity(dict->count + dict->count / 2 + 1);
+        if (!resize(dict, capacity)) return false;
+    }
+
+    uint32_t slot = emptySlot(dict->indexes, dict->capacity, hash);
+    setIndex(dict->indexes, dict->capacity, slot, dict->used);
+
+    entry_t *entry = &dict->entries[dict->used++];
+    entry->key = bits;
+    entry->value = value.raw;
+    entry->hash = hash;
+    entry->keyType = (uint8_t)key.type;
+    entry->valueType = (uint8_t)value.type;
+    dict->count++;
+    return true;
+}
+
+bool dict_remove(dict_t *dict, val_t key)
+{
+    if (dict->count == 0) return false;
+
+    uint64_t bits = keyBits(key);
+    int slot = findSlot(dict, bits, key.type, keyHash(key, bits));
+    if (slot < 0) return false;
+
+    entry_t *entry = &dict->entries[getIndex(dict->indexes, dict->capacity, slot)];
+    entry->keyType = VT_NIL;
+    entry->valueType = VT_NIL;
+    setIndex(dict->indexes, dict->capacity, slot, INDEX_REMOVED);
+    dict->count--;
+
+    // Failing to shrink only leaves the dict as it was, and so does
+    // skipping it at the heap limit.
+    if (dict->capacity > DICT_MIN && dict->count < DICT_USABLE(dict->capacity) / 4) {
+        int capacity = fitCapacity(dict->count * 2);
+        if (gc_fits(dict->gc, DICT_SIZE(capacity))) resize(dict, capacity);
+    }
+    return true;
+}
+
+bool dict_reserve(dict_t *dict, int count)
+{
+    int capacity = fitCapacity(count);
+
+    if (capacity <= dict->capacity) return true;
+    return resize(dict, capacity);
+}
+
+// Room for more keys without resizing, false instead of growing the
+// dict past the heap limit.
+bool dict_tryreserve(dict_t *dict, int more)
+{
+    if (dict->used + more <= DICT_USABLE(dict->capacity)) return true;
+
+    int capacity = fitCapacity(dict->count + more);
+    return gc_fits(dict->gc, DICT_SIZE(capacity)) && resize(dict, capacity);
+}
+
+// Replaces an empty dict with the same entries as from, in one block.
+bool dict_copy(dict_t *to, dict_t *from)
+{
+    if (from->count == 0) return true;
+
+    entry_t *entries = ALLOC(to->gc, DICT_SIZE(from->capacity));
+    if (entries == NULL) return false;
+
+    memcpy(entries, from->entries, DICT_SIZE(from->capacity));
+    to->entries = entries;
+    to->indexes = entries + DICT_USABLE(from->capacity);
+    to->capacity = from->capacity;
+    to->count = from->count;
+    to->used = from->used;
+    return true;
+}
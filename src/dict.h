@@ -0,0 +1,64 @@
+#pragma once
+
+#include "common.h"
+#include "value.h"
+
+// The keys of a map outside its array part, interned strings and
+// numbers, in a dense array of entries kept in insertion order. A hash
+// table of small indexes into that array finds them, so an empty slot
+// costs one to four bytes rather than a whole entry.
+
+#define DICT_MIN            8
+
+// Entries there is room for, the rest of the slots keep probes short.
+#define DICT_USABLE(cap)    ((cap) * 2 / 3)
+
+// Bytes per index, wide enough for any entry and the two markers.
+#define DICT_WIDTH(cap)     ((cap) <= 128 ? 1 : (cap) <= 32768 ? 2 : 4)
+
+// Key and value are split into their bits and their types so an entry
+// takes 24 bytes rather than the 32 of two values.
+typedef struct {
+    uint64_t key;       // The bits of a number or the string pointer.
+    uint64_t value;
+    uint32_t hash;
+    uint8_t keyType;    // VT_NUM or VT_OBJ, VT_NIL once removed.
+    uint8_t valueType;
+} entry_t;
+
+typedef struct {
+    int count;          // Live keys.
+    int used;           // Entries taken, removed ones included.
+    int capacity;       // Index slots, a power of two.
+    entry_t *entries;
+    void *indexes;      // After the entries, in the same block.
+    gc_t *gc;
+} dict_t;
+
+#define DICT_SIZE(cap)  ((cap) == 0 ? 0 : (size_t)DICT_USABLE(cap) * sizeof(entry_t) \
+                            + (size_t)(cap) * DICT_WIDTH(cap))
+
+void dict_init(dict_t *dict, gc_t *gc);
+void dict_free(dict_t *dict);
+
+// Keys are numbers or interned strings.
+bool dict_get(dict_t *dict, val_t key, val_t *value);
+bool dict_set(dict_t *dict, val_t key, val_t value);
+bool dict_remove(dict_t *dict, val_t key);
+bool dict_reserve(dict_t *dict, int count);
+bool dict_tryreserve(dict_t *dict, int more);
+bool dict_copy(dict_t *to, dict_t *from);
+
+// Whether one more key would make the dict resize.
+static inline bool dict_full(dict_t *dict) {
+    return dict->used + 1 > DICT_USABLE(dict->capacity);
+}
+
+// The key and value of an entry in use.
+static inline val_t dict_key(entry_t *entry) {
+    return (val_t){ .type = (vtype_t)entry->keyType, .raw = entry->key };
+}
+
+static inline val_t dict_value(entry_t *entry) {
+    return (val_t){ .type = (vtype_t)entry->valueType, .raw = entry->value };
+}
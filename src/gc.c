@@ -1,16 +1,57 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L     // For clock_gettime.
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
 
 #include "gc.h"
 #include "vm.h"
 #include "object.h"
+#include "channel.h"
+
+// The VM this thread runs, how many locks it holds that a collection
+// might want, and whether it has stopped the others.
+static THREAD_LOCAL vm_t *mutator;
+static THREAD_LOCAL int holds;
+static THREAD_LOCAL bool stopper;
 
 void gc_init(gc_t *gc)
 {
-    gc->next = 0;
-    gc->allocated = 0;
+    gc->next = GC_HEAP_START;
+    atomic_init(&gc->allocated, 0);
     gc->objects = NULL;
+    slab_init(&gc->slab);
+    mutex_init(&gc->heap);
+
+    gc->growth = GC_HEAP_GROW;
+    gc->minimum = GC_HEAP_START;
+    gc->limit = 0;
+
+    atomic_init(&gc->peak, 0);
+    gc->collections = 0;
+    gc->pauseTotal = 0;
+    gc->pauseMax = 0;
+    memset(gc->counts, 0, sizeof(gc->counts));
+
+    gc->vms = NULL;
+    mutex_init(&gc->lock);
+    cond_init(&gc->stopped);
+    cond_init(&gc->resumed);
+    atomic_init(&gc->stopping, false);
+    gc->running = 0;
+    gc->parked = 0;
+
+    gc->gray = NULL;
+    gc->grayCount = 0;
+    gc->grayCapacity = 0;
+    gc->collecting = false;
 }
 
 void gc_free(gc_t *gc)
@@ -22,21 +63,626 @@ void gc_free(gc_t *gc)
         obj_free(gc, object);
         object = next;
     }
+
+    free(gc->gray);
+    slab_free(&gc->slab);
+
+    mutex_destroy(&gc->heap);
+    mutex_destroy(&gc->lock);
+    cond_destroy(&gc->stopped);
+    cond_destroy(&gc->resumed);
 }
 
-void *gc_realloc(gc_t *gc, void *ptr, size_t old, size_t new)
+static bool inside(gc_t *gc)
+{
+    return mutator != NULL && mutator->gc == gc;
+}
+
+static tlab_t *tlabOf(gc_t *gc)
+{
+    return inside(gc) ? &mutator->tlab : NULL;
+}
+
+static void raisePeak(gc_t *gc, size_t size)
+{
+    size_t peak = atomic_load_explicit(&gc->peak, memory_order_relaxed);
+
+    while (size > peak && !atomic_compare_exchange_weak(&gc->peak, &peak, size)) {
+    }
+}
+
+// Gives the objects and counts of a VM to the gc, with the heap lock
+// held. Its cached blocks stay with it.
+static void handOver(gc_t *gc, tlab_t *tlab)
+{
+    if (tlab->objects != NULL) {
+        tlab->last->next = gc->objects;
+        gc->objects = tlab->objects;
+        tlab->objects = NULL;
+        tlab->last = NULL;
+    }
+
+    raisePeak(gc, atomic_fetch_add(&gc->allocated, (size_t)tlab->allocated)
+        + (size_t)tlab->allocated);
+    tlab->allocated = 0;
+
+    for (int i = 0; i < OT_COUNT; i++) {
+        gc->counts[i] += (size_t)tlab->counts[i];
+        tlab->counts[i] = 0;
+    }
+}
+
+// Returns up to count cached blocks of a class to the slab, with the
+// heap lock held.
+static void returnBlocks(gc_t *gc, tlab_t *tlab, int cls, int count)
+{
+    size_t size = (size_t)(cls + 1) * SLAB_ALIGN;
+
+    while (count-- > 0 && tlab->blocks[cls] != NULL) {
+        void *block = tlab->blocks[cls];
+        tlab->blocks[cls] = *(void **)block;
+        tlab->cached[cls]--;
+        slab_release(&gc->slab, block, size);
+    }
+}
+
+void gc_attach(gc_t *gc, vm_t *vm)
+{
+    // The caller is inside the heap or alone on it, so no collection
+    // walks the list meanwhile.
+    mutex_lock(&gc->lock);
+    vm->next = gc->vms;
+    gc->vms = vm;
+    mutex_unlock(&gc->lock);
+}
+
+void gc_detach(gc_t *gc, vm_t *vm)
+{
+    if (mutator == vm) gc_leave(gc);
+
+    mutex_lock(&gc->lock);
+
+    // From outside the heap, a collection may be running right now.
+    if (!inside(gc)) {
+        while (atomic_load(&gc->stopping)) cond_wait(&gc->resumed, &gc->lock);
+    }
+
+    vm_t **link = &gc->vms;
+
+    while (*link != NULL) {
+        if (*link == vm) {
+            *link = vm->next;
+            break;
+        }
+        link = &(*link)->next;
+    }
+
+    mutex_lock(&gc->heap);
+    handOver(gc, &vm->tlab);
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        returnBlocks(gc, &vm->tlab, i, vm->tlab.cached[i]);
+    }
+    mutex_unlock(&gc->heap);
+
+    mutex_unlock(&gc->lock);
+    vm->next = NULL;
+}
+
+void gc_enter(gc_t *gc, vm_t *vm)
+{
+    mutex_lock(&gc->lock);
+    while (atomic_load(&gc->stopping)) cond_wait(&gc->resumed, &gc->lock);
+    gc->running++;
+    mutex_unlock(&gc->lock);
+
+    mutator = vm;
+}
+
+void gc_leave(gc_t *gc)
+{
+    mutator = NULL;
+
+    mutex_lock(&gc->lock);
+    gc->running--;
+
+    // The collector may be waiting for this thread alone.
+    if (atomic_load(&gc->stopping)) cond_signal(&gc->stopped);
+    mutex_unlock(&gc->lock);
+}
+
+// Waits out a collection on another thread, with the lock held.
+static void waitResumed(gc_t *gc)
 {
-    gc->allocated += new - old;
+    bool counted = inside(gc);
 
-    if (new > old && gc->allocated > gc->next) {
-        // todo
-        //gc_collect(gc);
+    if (counted) {
+        gc->parked++;
+        cond_signal(&gc->stopped);
+    }
+
+    while (atomic_load(&gc->stopping)) cond_wait(&gc->resumed, &gc->lock);
+    if (counted) gc->parked--;
+}
+
+void gc_park(gc_t *gc)
+{
+    // A thread holding a lock goes on until it lets go, the collector
+    // waits for it.
+    if (stopper || holds > 0 || !inside(gc)) return;
+
+    mutex_lock(&gc->lock);
+    waitResumed(gc);
+    mutex_unlock(&gc->lock);
+}
+
+void gc_stop(gc_t *gc)
+{
+    mutex_lock(&gc->lock);
+
+    // Another thread got there first, let it finish.
+    while (atomic_load(&gc->stopping)) waitResumed(gc);
+
+    atomic_store(&gc->stopping, true);
+    int others = gc->running - (inside(gc) ? 1 : 0);
+    while (gc->parked < others) {
+        cond_wait(&gc->stopped, &gc->lock);
+        others = gc->running - (inside(gc) ? 1 : 0);
+    }
+
+    stopper = true;
+
+    mutex_lock(&gc->heap);
+    for (vm_t *vm = gc->vms; vm != NULL; vm = vm->next) {
+        handOver(gc, &vm->tlab);
+    }
+    mutex_unlock(&gc->heap);
+
+    mutex_unlock(&gc->lock);
+}
+
+void gc_resume(gc_t *gc)
+{
+    mutex_lock(&gc->lock);
+    stopper = false;
+    atomic_store(&gc->stopping, false);
+    cond_broadcast(&gc->resumed);
+    mutex_unlock(&gc->lock);
+}
+
+void gc_hold(gc_t *gc)
+{
+    holds++;
+}
+
+void gc_release(gc_t *gc)
+{
+    holds--;
+}
+
+static void markObject(gc_t *gc, obj_t *object)
+{
+    if (object == NULL || object->marked) return;
+    object->marked = true;
+
+    if (gc->grayCount >= gc->grayCapacity) {
+        gc->grayCapacity = GROW_CAPACITY(gc->grayCapacity);
+        gc->gray = realloc(gc->gray, gc->grayCapacity * sizeof(obj_t *));
+
+        if (gc->gray == NULL) {
+            fprintf(stderr, "Not enough memory to collect garbage.\n");
+            exit(1);
+        }
+    }
+
+    gc->gray[gc->grayCount++] = object;
+}
+
+static void markValue(gc_t *gc, val_t value)
+{
+    if (IS_OBJ(value)) markObject(gc, AS_OBJ(value));
+}
+
+static void markTable(gc_t *gc, tab_t *table)
+{
+    for (int i = 0; i < table->capacity; i++) {
+        str_t *key = tab_key(table, i);
+        if (key == NULL) continue;
+
+        markObject(gc, (obj_t *)key);
+        markValue(gc, tab_value(table, i));
+    }
+}
+
+static void markDict(gc_t *gc, dict_t *dict)
+{
+    for (int i = 0; i < dict->used; i++) {
+        entry_t *entry = &dict->entries[i];
+        if (entry->keyType == VT_NIL) continue;
+        markValue(gc, dict_key(entry));
+        markValue(gc, dict_value(entry));
+    }
+}
+
+// Queued tasks are referenced from the pool alone.
+static void markPool(gc_t *gc, pool_t *pool)
+{
+    for (future_t *future = pool->head; future != NULL; future = future->next) {
+        markObject(gc, (obj_t *)future);
+    }
+
+    for (int i = 0; i < pool->count; i++) {
+        deque_t *deque = &pool->workers[i].deque;
+        int64_t bottom = atomic_load(&deque->bottom);
+
+        for (int64_t j = atomic_load(&deque->top); j < bottom; j++) {
+            markObject(gc, (obj_t *)atomic_load(&deque->items[j & (DEQUE_SIZE - 1)]));
+        }
+    }
+}
+
+static void markRoots(gc_t *gc)
+{
+    for (vm_t *vm = gc->vms; vm != NULL; vm = vm->next) {
+        for (val_t *slot = vm->stack; slot < vm->top; slot++) {
+            markValue(gc, *slot);
+        }
+
+        for (int i = 0; i < vm->frameCount; i++) {
+            markObject(gc, (obj_t *)vm->frames[i].function);
+        }
+
+        markTable(gc, vm->globals);
+    }
+
+    if (gc->vms->pool != NULL) markPool(gc, gc->vms->pool);
+}
+
+static void blackenObject(gc_t *gc, obj_t *object)
+{
+    switch (object->type) {
+        case OT_STR:
+            break;
+        case OT_FUN: {
+            fun_t *function = (fun_t *)object;
+            arr_t *constants = &function->chunk.constants;
+            markObject(gc, (obj_t *)function->name);
+            for (int i = 0; i < constants->count; i++) {
+                markValue(gc, constants->values[i]);
+            }
+            break;
+        }
+        case OT_MAP: {
+            map_t *map = (map_t *)object;
+            for (int i = 0; i < map->arrayCapacity; i++) {
+                markValue(gc, map->array[i]);
+            }
+            markDict(gc, &map->dict);
+            break;
+        }
+        case OT_ROPE: {
+            // With the world stopped nobody walks the parts of a
+            // flattened rope anymore, they can go.
+            rope_t *rope = (rope_t *)object;
+            if (rope->flat != NULL) {
+                rope->left = NULL;
+                rope->right = NULL;
+            }
+            markObject(gc, rope->left);
+            markObject(gc, rope->right);
+            markObject(gc, (obj_t *)rope->flat);
+            break;
+        }
+        case OT_BUF:
+        case OT_F64ARRAY:
+            break;
+        case OT_PMAP:
+            markObject(gc, (obj_t *)((pmap_t *)object)->root);
+            break;
+        case OT_PNODE: {
+            pnode_t *node = (pnode_t *)object;
+            for (int i = 0; i < node->length; i++) {
+                markValue(gc, node->slots[i]);
+            }
+            break;
+        }
+        case OT_FUTURE: {
+            future_t *future = (future_t *)object;
+            markValue(gc, future->result);
+
+            // The call is of no more use once it has run.
+            if (atomic_load(&future->state) != FUTURE_DONE) {
+                for (int i = 0; i <= future->argCount; i++) {
+                    markValue(gc, future->values[i]);
+                }
+            }
+            break;
+        }
+        case OT_CHANNEL: {
+            channel_t *channel = (channel_t *)object;
+            size_t sent = atomic_load(&channel->sent);
+
+            // Only the cells holding a value that nobody received yet.
+            for (size_t i = atomic_load(&channel->received); i < sent; i++) {
+                cell_t *cell = &channel->cells[i & (channel->capacity - 1)];
+                if (atomic_load(&cell->sequence) == i + 1) markValue(gc, cell->value);
+            }
+            break;
+        }
+        case OT_SLICE: {
+            // Likewise a flattened slice moves onto its copy.
+            slice_t *slice = (slice_t *)object;
+            if (slice->flat != NULL) {
+                slice->chars = slice->flat->chars;
+                slice->parent = NULL;
+            }
+            markObject(gc, (obj_t *)slice->parent);
+            markObject(gc, (obj_t *)slice->flat);
+            break;
+        }
+        case OT_COUNT:
+            break;
+    }
+}
+
+static void traceReferences(gc_t *gc)
+{
+    while (gc->grayCount > 0) {
+        obj_t *object = gc->gray[--gc->grayCount];
+        blackenObject(gc, object);
+    }
+}
+
+static void sweep(gc_t *gc)
+{
+    obj_t *previous = NULL;
+    obj_t *object = gc->objects;
+
+    while (object != NULL) {
+        if (object->marked) {
+            object->marked = false;
+            previous = object;
+            object = object->next;
+        }
+        else {
+            obj_t *unreached = object;
+            object = object->next;
+
+            if (previous != NULL) previous->next = object;
+            else gc->objects = object;
+
+            obj_free(gc, unreached);
+        }
+    }
+}
+
+// Seconds on a monotonic clock. A pause is wall time, the CPU time of
+// the process would add up every thread.
+static double now()
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+#endif
+}
+
+void gc_collect(gc_t *gc)
+{
+    if (gc->collecting) return;
+
+    gc_stop(gc);
+
+    if (gc->vms == NULL) {
+        gc_resume(gc);
+        return;
+    }
+
+    gc->collecting = true;
+    double start = now();
+
+    markRoots(gc);
+    traceReferences(gc);
+
+    // The intern table holds its strings weakly, drop the dead ones
+    // before their memory goes away.
+    intern_sweep(gc->vms->strings);
+    sweep(gc);
+
+    // Nobody is looking up a global now, so the arrays the table has
+    // outgrown can go.
+    tab_reclaim(gc->vms->globals);
+
+    // What the sweep freed was counted by this thread.
+    tlab_t *tlab = tlabOf(gc);
+    if (tlab != NULL) {
+        mutex_lock(&gc->heap);
+        handOver(gc, tlab);
+        mutex_unlock(&gc->heap);
+    }
+
+    size_t allocated = atomic_load(&gc->allocated);
+    gc->next = (size_t)(allocated * gc->growth);
+    if (gc->next < gc->minimum) gc->next = gc->minimum;
+
+    double pause = now() - start;
+    gc->pauseTotal += pause;
+    if (pause > gc->pauseMax) gc->pauseMax = pause;
+    gc->collections++;
+
+    gc->collecting = false;
+    gc_resume(gc);
+}
+
+size_t gc_allocated(gc_t *gc)
+{
+    tlab_t *tlab = tlabOf(gc);
+    size_t allocated = atomic_load(&gc->allocated);
+
+    return tlab != NULL ? allocated + (size_t)tlab->allocated : allocated;
+}
+
+// Allocations are counted by the VM that makes them, and only added up
+// once they make a difference.
+static void count(gc_t *gc, tlab_t *tlab, ptrdiff_t delta)
+{
+    if (tlab != NULL) {
+        tlab->allocated += delta;
+        if (tlab->allocated < TLAB_FLUSH && tlab->allocated > -TLAB_FLUSH) return;
+
+        delta = tlab->allocated;
+        tlab->allocated = 0;
+    }
+
+    raisePeak(gc, atomic_fetch_add(&gc->allocated, (size_t)delta) + (size_t)delta);
+}
+
+static bool overLimit(gc_t *gc)
+{
+    return gc->limit != 0 && gc_allocated(gc) > gc->limit && !gc->collecting;
+}
+
+// For allocations that can be done without, which are skipped rather
+// than raise at the limit.
+bool gc_fits(gc_t *gc, size_t size)
+{
+    return gc->limit == 0 || gc_allocated(gc) + SLAB_ROUND(size) <= gc->limit;
+}
+
+static void *outOfMemory(gc_t *gc, tlab_t *tlab, ptrdiff_t delta)
+{
+    count(gc, tlab, -delta);
+
+    // Unwinds to the running VM, or exits when nothing is protected. A
+    // thread holding a lock gets a NULL instead.
+    if (!gc->collecting && holds == 0) vm_nomem(gc);
+    return NULL;
+}
+
+static void *takeBlock(gc_t *gc, tlab_t *tlab, size_t size)
+{
+    int cls = SLAB_CLASS(size);
+
+    if (tlab->blocks[cls] == NULL) {
+        mutex_lock(&gc->heap);
+
+        for (int i = 0; i < TLAB_BLOCKS / 2; i++) {
+            void *block = slab_alloc(&gc->slab, size);
+            if (block == NULL) break;
+
+            *(void **)block = tlab->blocks[cls];
+            tlab->blocks[cls] = block;
+            tlab->cached[cls]++;
+        }
+
+        mutex_unlock(&gc->heap);
+        if (tlab->blocks[cls] == NULL) return NULL;
+    }
+
+    void *block = tlab->blocks[cls];
+    tlab->blocks[cls] = *(void **)block;
+    tlab->cached[cls]--;
+    return block;
+}
+
+static void giveBlock(gc_t *gc, tlab_t *tlab, void *block, size_t size)
+{
+    if (block == NULL) return;
+
+    // Past the size classes, blocks come from malloc, which has locks
+    // of its own.
+    if (size > SLAB_MAX_SIZE) {
+        free(block);
+        return;
+    }
+
+    int cls = SLAB_CLASS(size);
+    *(void **)block = tlab->blocks[cls];
+    tlab->blocks[cls] = block;
+
+    if (++tlab->cached[cls] > TLAB_BLOCKS) {
+        mutex_lock(&gc->heap);
+        returnBlocks(gc, tlab, cls, TLAB_BLOCKS / 2);
+        mutex_unlock(&gc->heap);
+    }
+}
+
+// Goes through the buffer of the VM if this thread runs one, through
+// the locked slab otherwise.
+static void *reallocate(gc_t *gc, tlab_t *tlab, void *ptr, size_t old, size_t new)
+{
+    if (tlab == NULL) {
+        mutex_lock(&gc->heap);
+        void *result = slab_realloc(&gc->slab, ptr, old, new);
+        mutex_unlock(&gc->heap);
+        return result;
     }
 
     if (new == 0) {
-        free(ptr);
+        giveBlock(gc, tlab, ptr, old);
         return NULL;
     }
 
-    return realloc(ptr, new);
+    if (ptr != NULL) {
+        if (old > SLAB_MAX_SIZE && new > SLAB_MAX_SIZE) return realloc(ptr, new);
+        if (SLAB_ROUND(old) == SLAB_ROUND(new)) return ptr;
+    }
+
+    void *block = new > SLAB_MAX_SIZE ? malloc(new) : takeBlock(gc, tlab, new);
+    if (block == NULL || ptr == NULL) return block;
+
+    memcpy(block, ptr, old < new ? old : new);
+    giveBlock(gc, tlab, ptr, old);
+    return block;
+}
+
+void *gc_realloc(gc_t *gc, void *ptr, size_t old, size_t new)
+{
+    tlab_t *tlab = tlabOf(gc);
+    ptrdiff_t delta = (ptrdiff_t)SLAB_ROUND(new) - (ptrdiff_t)SLAB_ROUND(old);
+    count(gc, tlab, delta);
+
+    if (new > old && holds == 0) {
+        gc_safepoint(gc);
+#ifdef DEBUG_STRESS_GC
+        gc_collect(gc);
+#else
+        if (gc_allocated(gc) > gc->next || overLimit(gc)) gc_collect(gc);
+#endif
+        if (overLimit(gc)) return outOfMemory(gc, tlab, delta);
+    }
+
+    void *result = reallocate(gc, tlab, ptr, old, new);
+
+    if (result == NULL && new > 0) {
+        // Give the collector a chance to free some memory, then retry.
+        if (holds == 0) gc_collect(gc);
+        result = reallocate(gc, tlab, ptr, old, new);
+        if (result == NULL) return outOfMemory(gc, tlab, delta);
+    }
+
+    return result;
+}
+
+void gc_track(gc_t *gc, obj_t *object)
+{
+    tlab_t *tlab = tlabOf(gc);
+
+    if (tlab != NULL) {
+        if (tlab->objects == NULL) tlab->last = object;
+        object->next = tlab->objects;
+        tlab->objects = object;
+        tlab->counts[object->type]++;
+        return;
+    }
+
+    mutex_lock(&gc->heap);
+    object->next = gc->objects;
+    gc->objects = object;
+    gc->counts[object->type]++;
+    mutex_unlock(&gc->heap);
 }
@@ -1,15 +1,102 @@
 #pragma once
 
+#include <stdatomic.h>
+
 #include "common.h"
 #include "object.h"
+#include "slab.h"
+#include "sync.h"
+
+#define ALLOC(gc, size) \
+    gc_realloc(gc, NULL, 0, size)
+
+#define FREE(gc, type, pointer) \
+    gc_realloc(gc, pointer, sizeof(type), 0)
+
+#define FREE_ARRAY(gc, type, pointer, count) \
+    gc_realloc(gc, pointer, sizeof(type) * (count), 0)
+
+#define GC_HEAP_GROW        2
+#define GC_HEAP_START       (1024 * 1024)
+
+#define TLAB_BLOCKS         32              // Free blocks a VM keeps per size class.
+#define TLAB_FLUSH          (64 * 1024)     // Bytes a VM counts before the gc hears of them.
+
+// What a VM allocates from without taking a lock: free blocks of each
+// size class set aside for it, the objects it made and what it counted,
+// all handed over to the gc whenever the world stops.
+typedef struct {
+    void *blocks[SLAB_CLASSES];
+    int cached[SLAB_CLASSES];
+    obj_t *objects;
+    obj_t *last;
+    ptrdiff_t allocated;
+    ptrdiff_t counts[OT_COUNT];
+} tlab_t;
 
 struct _gc {
-    size_t allocated;
+    atomic_size_t allocated;
     size_t next;
-    obj_t *objects;
+    obj_t *objects;     // Those no VM holds, guarded by the heap lock.
+    slab_t slab;
+    mutex_t heap;       // The heap lock, it guards the slab too.
+
+    double growth;
+    size_t minimum;
+    size_t limit;       // Hard cap on the heap size, 0 for none.
+
+    atomic_size_t peak;
+    size_t collections;
+    size_t counts[OT_COUNT];
+    double pauseTotal;
+    double pauseMax;
+
+    vm_t *vms;          // Attached VMs, their stacks and globals are roots.
+    mutex_t lock;       // Guards the list and the counts below.
+    cond_t stopped;
+    cond_t resumed;
+    atomic_bool stopping;
+    int running;        // Threads inside one of the VMs.
+    int parked;         // Of them, those waiting at a safepoint.
+
+    obj_t **gray;
+    int grayCount;
+    int grayCapacity;
+    bool collecting;
 };
 
 void gc_init(gc_t *gc);
 void gc_free(gc_t *gc);
 
+void gc_attach(gc_t *gc, vm_t *vm);
+void gc_detach(gc_t *gc, vm_t *vm);
+void gc_collect(gc_t *gc);
+bool gc_snapshot(gc_t *gc, const char *path);
+
+// A thread runs a VM between enter and leave, and leaves before it
+// blocks so that a collection doesn't wait on it. It must not touch the
+// heap until it enters again.
+void gc_enter(gc_t *gc, vm_t *vm);
+void gc_leave(gc_t *gc);
+void gc_park(gc_t *gc);
+
+// Stops every other thread at its next safepoint, a call or an
+// allocation, and hands their objects over to the gc. Nothing may be
+// allocated until gc_resume.
+void gc_stop(gc_t *gc);
+void gc_resume(gc_t *gc);
+
+// Code holding a lock allocates between these, it never stops or
+// collects there.
+void gc_hold(gc_t *gc);
+void gc_release(gc_t *gc);
+
 void *gc_realloc(gc_t *gc, void *ptr, size_t old, size_t new);
+void gc_track(gc_t *gc, obj_t *object);
+size_t gc_allocated(gc_t *gc);
+bool gc_fits(gc_t *gc, size_t size);
+
+static inline void gc_safepoint(gc_t *gc)
+{
+    if (atomic_load_explicit(&gc->stopping, memory_order_relaxed)) gc_park(gc);
+}
@@ -1,21 +1,27 @@
 #pragma once
 
 #include "common.h"
-#include "value.h"
 
-typedef struct {
-    uint64_t key;
-    val_t value;
-} index_t;
+#define HASH_ZERO       0x0000000000000000ull
+#define HASH_NEG_ZERO   0x8000000000000000ull
+#define HASH_NAN        0x7FF8000000000000ull
 
-typedef struct {
-    int count;
-    int capacity;
-    index_t *indexes;
-} hash_t;
+// Keys are the bits of doubles, so -0.0 becomes 0.0 and every NaN the
+// same quiet NaN.
+static inline uint64_t hash_normalize(uint64_t key) {
+    if (key == HASH_NEG_ZERO) return HASH_ZERO;
+    if ((key & 0x7FF0000000000000ull) == 0x7FF0000000000000ull
+        && (key & 0x000FFFFFFFFFFFFFull) != 0) return HASH_NAN;
+    return key;
+}
 
-void hash_init(hash_t *hash);
-void hash_free(hash_t *hash);
-
-bool hash_get(hash_t *hash, uint64_t key, val_t *value);
-bool hash_set(hash_t *hash, uint64_t key, val_t value);
+// The bits that vary between small integers are at the top of a double,
+// spread them over the bits that are masked into an index.
+static inline uint64_t hash_mix(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ull;
+    key ^= key >> 33;
+    return key;
+}
@@ -0,0 +1,199 @@
+#include <string.h>
+
+#include "intern.h"
+#include "object.h"
+#include "swiss.h"
+#include "gc.h"
+
+#define INTERN_MIN      SWISS_GROUP
+
+// Keys and control bytes share one block, the keys first for alignment.
+#define BLOCK_SIZE(cap) ((size_t)(cap) * (sizeof(str_t *) + 1))
+
+#define SHARD_OF(t, h)  (&(t)->shards[(uint32_t)(h) >> (32 - INTERN_SHARD_BITS)])
+
+void intern_init(intern_t *table, gc_t *gc)
+{
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        shard_t *shard = &table->shards[i];
+        mutex_init(&shard->lock);
+        shard->count = 0;
+        shard->deleted = 0;
+        shard->capacity = 0;
+        shard->ctrl = NULL;
+        shard->keys = NULL;
+    }
+
+    table->gc = gc;
+}
+
+void intern_free(intern_t *table)
+{
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        shard_t *shard = &table->shards[i];
+        gc_realloc(table->gc, shard->keys, BLOCK_SIZE(shard->capacity), 0);
+        mutex_destroy(&shard->lock);
+    }
+}
+
+int intern_count(intern_t *table)
+{
+    int count = 0;
+
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        count += table->shards[i].count;
+    }
+
+    return count;
+}
+
+static int findSlot(uint8_t *ctrl, int capacity, uint32_t hash)
+{
+    uint32_t mask = capacity / SWISS_GROUP - 1;
+    uint32_t group = SWISS_H1(hash) & mask;
+
+    for (uint32_t step = 0;; SWISS_NEXT(group, step, mask)) {
+        uint32_t free = swiss_free(ctrl + group * SWISS_GROUP);
+        if (free != 0) return group * SWISS_GROUP + bit_first(free);
+    }
+}
+
+static bool resize(gc_t *gc, shard_t *shard, int capacity)
+{
+    // Called with the lock held or the world stopped, neither of which
+    // lets the allocation collect.
+    str_t **keys = ALLOC(gc, BLOCK_SIZE(capacity));
+    if (keys == NULL) return false;
+
+    uint8_t *ctrl = (uint8_t *)(keys + capacity);
+    memset(ctrl, SWISS_EMPTY, capacity);
+
+    for (int i = 0; i < shard->capacity; i++) {
+        if (!SWISS_IS_FULL(shard->ctrl[i])) continue;
+
+        str_t *key = shard->keys[i];
+        int slot = findSlot(ctrl, capacity, key->hash);
+        ctrl[slot] = SWISS_H2(key->hash);
+        keys[slot] = key;
+    }
+
+    gc_realloc(gc, shard->keys, BLOCK_SIZE(shard->capacity), 0);
+    shard->keys = keys;
+    shard->ctrl = ctrl;
+    shard->capacity = capacity;
+    shard->deleted = 0;
+    return true;
+}
+
+static str_t *findKey(shard_t *shard, const char *chars, int length, uint32_t hash)
+{
+    if (shard->count == 0) return NULL;
+
+    uint32_t mask = shard->capacity / SWISS_GROUP - 1;
+    uint32_t group = SWISS_H1(hash) & mask;
+    uint8_t h2 = SWISS_H2(hash);
+
+    for (uint32_t step = 0;; SWISS_NEXT(group, step, mask)) {
+        const uint8_t *ctrl = shard->ctrl + group * SWISS_GROUP;
+
+        for (uint32_t match = swiss_match(ctrl, h2); match != 0; match &= match - 1) {
+            str_t *key = shard->keys[group * SWISS_GROUP + bit_first(match)];
+
+            if (key->hash == hash && key->length == length
+                && memcmp(key->chars, chars, length) == 0) {
+                return key;
+            }
+        }
+
+        if (swiss_empty(ctrl) != 0) return NULL;
+    }
+}
+
+str_t *intern_find(intern_t *table, const char *chars, int length, uint32_t hash)
+{
+    shard_t *shard = SHARD_OF(table, hash);
+
+    mutex_lock(&shard->lock);
+    str_t *key = findKey(shard, chars, length, hash);
+    mutex_unlock(&shard->lock);
+    return key;
+}
+
+// Returns the string interned with the same characters, which is this
+// one unless another thread got there first, or NULL when out of memory.
+str_t *intern_add(intern_t *table, str_t *string)
+{
+    shard_t *shard = SHARD_OF(table, string->hash);
+
+    mutex_lock(&shard->lock);
+    gc_hold(table->gc);
+
+    str_t *key = findKey(shard, string->chars, string->length, string->hash);
+    if (key != NULL) goto _done;
+
+    if (shard->count + shard->deleted + 1 > SWISS_MAX_LOAD(shard->capacity)) {
+        // Mostly tombstones, so clean them out rather than growing.
+        int capacity = shard->capacity;
+        if (capacity == 0) capacity = INTERN_MIN;
+        else if (shard->count + 1 > capacity / 2) capacity *= 2;
+
+        if (!resize(table->gc, shard, capacity)) goto _done;
+    }
+
+    int slot = findSlot(shard->ctrl, shard->capacity, string->hash);
+    if (shard->ctrl[slot] == SWISS_DELETED) shard->deleted--;
+
+    shard->ctrl[slot] = SWISS_H2(string->hash);
+    shard->keys[slot] = string;
+    shard->count++;
+
+    string->interned = true;
+    key = string;
+
+_done:
+    gc_release(table->gc);
+    mutex_unlock(&shard->lock);
+    return key;
+}
+
+// Runs with the world stopped, so the locks are free.
+static void sweepShard(gc_t *gc, shard_t *shard)
+{
+    int removed = 0;
+
+    for (int i = 0; i < shard->capacity; i++) {
+        if (!SWISS_IS_FULL(shard->ctrl[i]) || shard->keys[i]->obj.marked) continue;
+
+        // No probe ever went past a group that still has an empty slot,
+        // so a slot there can be emptied instead of left as a tombstone.
+        if (swiss_empty(shard->ctrl + (i & ~(SWISS_GROUP - 1))) != 0) {
+            shard->ctrl[i] = SWISS_EMPTY;
+        }
+        else {
+            shard->ctrl[i] = SWISS_DELETED;
+            shard->deleted++;
+        }
+
+        shard->keys[i] = NULL;
+        shard->count--;
+        removed++;
+    }
+
+    if (removed == 0) return;
+
+    int capacity = shard->capacity;
+    while (capacity > INTERN_MIN && shard->count < capacity / 4) {
+        capacity /= 2;
+    }
+
+    if (capacity < shard->capacity || shard->deleted > shard->capacity / 4) {
+        resize(gc, shard, capacity);
+    }
+}
+
+void intern_sweep(intern_t *table)
+{
+    for (int i = 0; i < INTERN_SHARDS; i++) {
+        sweepShard(table->gc, &table->shards[i]);
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "common.h"
+#include "value.h"
+#include "sync.h"
+
+// Strings pick their shard by the top bits of the hash.
+#define INTERN_SHARD_BITS   4
+#define INTERN_SHARDS       (1 << INTERN_SHARD_BITS)
+
+typedef struct {
+    mutex_t lock;
+    int count;
+    int deleted;
+    int capacity;       // A power of two, a multiple of the group size.
+    uint8_t *ctrl;
+    str_t **keys;
+} shard_t;
+
+// The set of interned strings, held weakly. It is split in shards with
+// a lock each, so that threads interning at once seldom wait.
+typedef struct {
+    shard_t shards[INTERN_SHARDS];
+    gc_t *gc;
+} intern_t;
+
+void intern_init(intern_t *table, gc_t *gc);
+void intern_free(intern_t *table);
+int intern_count(intern_t *table);
+
+str_t *intern_find(intern_t *table, const char *chars, int length, uint32_t hash);
+str_t *intern_add(intern_t *table, str_t *string);
+void intern_sweep(intern_t *table);
@@ -0,0 +1,110 @@
+#include "libs.h"
+#include "vm.h"
+#include "object.h"
+#include "channel.h"
+
+// Ropes and slices fill in their flat string lazily, the receiver gets
+// one that no thread will write to anymore. Plain strings and numbers
+// go as they are, maps stay with their thread.
+static bool sendable(vm_t *vm, val_t *value)
+{
+    if (IS_NIL(*value) || !obj_shareable(*value)) return false;
+    if (IS_ROPE(*value) || IS_SLICE(*value)) str_flatten(vm, value);
+    return true;
+}
+
+// new(capacity), rounded up to a power of two.
+static val_t channel_new_(vm_t *vm, int argc, val_t *args)
+{
+    int capacity = argc > 0 && IS_NUM(args[0]) ? AS_INT(args[0]) : 1;
+    return VAL_OBJ(channel_new(vm, capacity));
+}
+
+// send(channel, value) waits for room, false once the channel is closed.
+// Nil can't be sent, it is what receiving from a closed channel gives,
+// and neither can a map.
+static val_t channel_send_(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 2 || !IS_CHANNEL(args[0]) || !sendable(vm, &args[1])) return VAL_FALSE;
+
+    return VAL_BOOL(channel_send(vm, AS_CHANNEL(args[0]), args[1]));
+}
+
+static val_t channel_trysend_(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 2 || !IS_CHANNEL(args[0]) || !sendable(vm, &args[1])) return VAL_FALSE;
+
+    return VAL_BOOL(channel_trysend(AS_CHANNEL(args[0]), args[1]));
+}
+
+// recv(channel) waits for a value, nil once the channel is closed and
+// drained.
+static val_t channel_recv_(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 1 || !IS_CHANNEL(args[0])) return VAL_NIL;
+
+    val_t value;
+    return channel_recv(vm, AS_CHANNEL(args[0]), &value) ? value : VAL_NIL;
+}
+
+static val_t channel_tryrecv_(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 1 || !IS_CHANNEL(args[0])) return VAL_NIL;
+
+    val_t value;
+    return channel_tryrecv(AS_CHANNEL(args[0]), &value) ? value : VAL_NIL;
+}
+
+// close(channel), whatever is in it can still be received.
+static val_t channel_close_(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 1 || !IS_CHANNEL(args[0])) return VAL_NIL;
+
+    channel_close(AS_CHANNEL(args[0]));
+    return VAL_NIL;
+}
+
+// select(list, block) receives from the first of the list's channels to
+// have a value and returns [index, value]. Nil when all are closed and
+// drained, or at once when none has a value and block is false.
+static val_t channel_select_(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 1 || !IS_MAP(args[0])) return VAL_NIL;
+    map_t *list = AS_MAP(args[0]);
+    bool block = argc < 2 || !IS_FALSEY(args[1]);
+
+    // The channels from 0 up to the list's first gap.
+    channel_t *channels[CHANNEL_SELECT_MAX];
+    int count = 0;
+    while (count < list->arrayCapacity && count < CHANNEL_SELECT_MAX
+            && IS_CHANNEL(list->array[count])) {
+        channels[count] = AS_CHANNEL(list->array[count]);
+        count++;
+    }
+    if (count == 0) return VAL_NIL;
+
+    val_t value;
+    int index = channel_select(vm, channels, count, block, &value);
+    if (index < 0) return VAL_NIL;
+
+    vm_push(vm, value);
+    map_t *result = map_new(vm, 2, 0);
+    map_seti(vm, result, 0, VAL_NUM(index));
+    map_seti(vm, result, 1, vm_pop(vm));
+    return VAL_OBJ(result);
+}
+
+void load_libchannel(vm_t *vm)
+{
+    map_t *channel = map_new(vm, 0, 0);
+
+    map_set(vm, channel, "new", VAL_CFN(channel_new_));
+    map_set(vm, channel, "send", VAL_CFN(channel_send_));
+    map_set(vm, channel, "trysend", VAL_CFN(channel_trysend_));
+    map_set(vm, channel, "recv", VAL_CFN(channel_recv_));
+    map_set(vm, channel, "tryrecv", VAL_CFN(channel_tryrecv_));
+    map_set(vm, channel, "close", VAL_CFN(channel_close_));
+    map_set(vm, channel, "select", VAL_CFN(channel_select_));
+
+    set_global(vm, "channel", VAL_OBJ(channel));
+}
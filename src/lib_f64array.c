@@ -0,0 +1,100 @@
+#include <limits.h>
+#include <string.h>
+
+#include "libs.h"
+#include "vm.h"
+#include "object.h"
+
+static int clampIndex(int argc, val_t *args, int i, int fallback, int length)
+{
+    if (i >= argc || !IS_NUM(args[i])) return fallback;
+
+    int index = AS_INT(args[i]);
+
+    if (index < 0) index += length;
+    if (index < 0) return 0;
+    if (index > length) return length;
+    return index;
+}
+
+// new(length, fill) or new(list), the list's numbers from 0 up to its
+// first gap.
+static val_t f64array_new_(vm_t *vm, int argc, val_t *args)
+{
+    if (argc > 0 && IS_MAP(args[0])) {
+        map_t *list = AS_MAP(args[0]);
+
+        int length = 0;
+        while (length < list->arrayCapacity && IS_NUM(list->array[length])) length++;
+
+        f64array_t *array = f64array_new(vm, length);
+        for (int i = 0; i < length; i++) {
+            array->values[i] = AS_NUM(list->array[i]);
+        }
+        return VAL_OBJ(array);
+    }
+
+    // Checked as a double, a length past INT_MAX would overflow AS_INT.
+    if (argc < 1 || !IS_NUM(args[0])) return VAL_NIL;
+    if (!(AS_NUM(args[0]) >= 0 && AS_NUM(args[0]) <= INT_MAX)) return VAL_NIL;
+
+    f64array_t *array = f64array_new(vm, AS_INT(args[0]));
+
+    if (argc > 1 && IS_NUM(args[1]) && AS_NUM(args[1]) != 0) {
+        double fill = AS_NUM(args[1]);
+        for (int i = 0; i < array->length; i++) {
+            array->values[i] = fill;
+        }
+    }
+    return VAL_OBJ(array);
+}
+
+static val_t f64array_len(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 1 || !IS_F64ARRAY(args[0])) return VAL_NIL;
+
+    return VAL_NUM(AS_F64ARRAY(args[0])->length);
+}
+
+// slice(array, start, end) copies out a range, negative indexes count
+// from the end.
+static val_t f64array_slice(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 1 || !IS_F64ARRAY(args[0])) return VAL_NIL;
+    int length = AS_F64ARRAY(args[0])->length;
+
+    int start = clampIndex(argc, args, 1, 0, length);
+    int end = clampIndex(argc, args, 2, length, length);
+    if (end < start) end = start;
+
+    f64array_t *slice = f64array_new(vm, end - start);
+    memcpy(slice->values, AS_F64ARRAY(args[0])->values + start,
+        (size_t)(end - start) * sizeof(double));
+    return VAL_OBJ(slice);
+}
+
+// copy(to, from, at) writes as much of from as fits into to at index at.
+static val_t f64array_copy(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 2 || !IS_F64ARRAY(args[0]) || !IS_F64ARRAY(args[1])) return VAL_NIL;
+    f64array_t *to = AS_F64ARRAY(args[0]);
+    f64array_t *from = AS_F64ARRAY(args[1]);
+
+    int at = clampIndex(argc, args, 2, 0, to->length);
+    int count = to->length - at < from->length ? to->length - at : from->length;
+
+    memmove(to->values + at, from->values, (size_t)count * sizeof(double));
+    return args[0];
+}
+
+void load_libf64array(vm_t *vm)
+{
+    map_t *f64array = map_new(vm, 0, 0);
+
+    map_set(vm, f64array, "new", VAL_CFN(f64array_new_));
+    map_set(vm, f64array, "len", VAL_CFN(f64array_len));
+    map_set(vm, f64array, "slice", VAL_CFN(f64array_slice));
+    map_set(vm, f64array, "copy", VAL_CFN(f64array_copy));
+
+    set_global(vm, "f64array", VAL_OBJ(f64array));
+}
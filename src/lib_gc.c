@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "libs.h"
+#include "vm.h"
+#include "gc.h"
+#include "object.h"
+
+static const char *typeNames[OT_COUNT] = {
+    [OT_STR] = "str",
+    [OT_FUN] = "fn",
+    [OT_MAP] = "map",
+    [OT_ROPE] = "rope",
+    [OT_BUF] = "strbuf",
+    [OT_SLICE] = "slice",
+    [OT_F64ARRAY] = "f64array",
+    [OT_PMAP] = "pmap",
+    [OT_PNODE] = "pnode",
+    [OT_FUTURE] = "future",
+    [OT_CHANNEL] = "channel"
+};
+
+static val_t gc_collect_(vm_t *vm, int argc, val_t *args)
+{
+    size_t before = gc_allocated(vm->gc);
+    gc_collect(vm->gc);
+
+    return VAL_NUM((double)before - (double)gc_allocated(vm->gc));
+}
+
+static val_t gc_count(vm_t *vm, int argc, val_t *args)
+{
+    return VAL_NUM((double)gc_allocated(vm->gc));
+}
+
+static val_t gc_stats(vm_t *vm, int argc, val_t *args)
+{
+    gc_t *gc = vm->gc;
+    map_t *stats = map_new(vm, 0, 0);
+    size_t counts[OT_COUNT];
+    size_t objects = 0;
+
+    // Read with the world stopped so that the numbers agree. Filling in
+    // the map allocates, which has to wait until after.
+    gc_stop(gc);
+    double allocated = (double)gc->allocated;
+    double peak = (double)gc->peak;
+    double mapped = (double)gc->slab.mapped;
+    int strings = intern_count(vm->strings);
+    memcpy(counts, gc->counts, sizeof(counts));
+    gc_resume(gc);
+
+    map_set(vm, stats, "allocated", VAL_NUM(allocated));
+    map_set(vm, stats, "peak", VAL_NUM(peak));
+    map_set(vm, stats, "next", VAL_NUM((double)gc->next));
+    map_set(vm, stats, "limit", VAL_NUM((double)gc->limit));
+    map_set(vm, stats, "mapped", VAL_NUM(mapped));
+    map_set(vm, stats, "collections", VAL_NUM((double)gc->collections));
+    map_set(vm, stats, "pause", VAL_NUM(gc->pauseTotal));
+    map_set(vm, stats, "maxpause", VAL_NUM(gc->pauseMax));
+    map_set(vm, stats, "strings", VAL_NUM(strings));
+
+    for (int i = 0; i < OT_COUNT; i++) {
+        map_set(vm, stats, typeNames[i], VAL_NUM((double)counts[i]));
+        objects += counts[i];
+    }
+
+    map_set(vm, stats, "objects", VAL_NUM((double)objects));
+    return VAL_OBJ(stats);
+}
+
+static val_t gc_snapshot_(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 1 || !IS_STRING(args[0])) return VAL_FALSE;
+
+    str_t *path = str_flatten(vm, &args[0]);
+    return VAL_BOOL(gc_snapshot(vm->gc, path->chars));
+}
+
+static val_t gc_growth(vm_t *vm, int argc, val_t *args)
+{
+    double previous = vm->gc->growth;
+
+    if (argc > 0 && IS_NUM(args[0]) && AS_NUM(args[0]) > 1) {
+        vm->gc->growth = AS_NUM(args[0]);
+    }
+
+    return VAL_NUM(previous);
+}
+
+static val_t gc_minheap(vm_t *vm, int argc, val_t *args)
+{
+    double previous = (double)vm->gc->minimum;
+
+    if (argc > 0 && IS_NUM(args[0]) && AS_NUM(args[0]) >= 0) {
+        vm->gc->minimum = (size_t)AS_NUM(args[0]);
+        if (vm->gc->next < vm->gc->minimum) vm->gc->next = vm->gc->minimum;
+    }
+
+    return VAL_NUM(previous);
+}
+
+void load_libgc(vm_t *vm)
+{
+    map_t *gc = map_new(vm, 0, 0);
+
+    map_set(vm, gc, "collect", VAL_CFN(gc_collect_));
+    map_set(vm, gc, "count", VAL_CFN(gc_count));
+    map_set(vm, gc, "stats", VAL_CFN(gc_stats));
+    map_set(vm, gc, "snapshot", VAL_CFN(gc_snapshot_));
+    map_set(vm, gc, "growth", VAL_CFN(gc_growth));
+    map_set(vm, gc, "minheap", VAL_CFN(gc_minheap));
+
+    set_global(vm, "gc", VAL_OBJ(gc));
+}
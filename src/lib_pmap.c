@@ -0,0 +1,75 @@
+#include "libs.h"
+#include "vm.h"
+#include "object.h"
+
+static bool isKey(val_t key)
+{
+    return IS_NUM(key) || IS_STRING(key);
+}
+
+// new() or new(map), a snapshot of the map's keys.
+static val_t pmap_new_(vm_t *vm, int argc, val_t *args)
+{
+    pmap_t *result = pmap_new(vm, 0, NULL);
+    if (argc < 1 || !IS_MAP(args[0])) return VAL_OBJ(result);
+
+    map_t *map = AS_MAP(args[0]);
+    vm_push(vm, VAL_OBJ(result));
+
+    for (int i = 0; i < map->arrayCapacity; i++) {
+        if (IS_NIL(map->array[i])) continue;
+
+        vm->top[-1] = VAL_OBJ(pmap_set(vm, AS_PMAP(vm->top[-1]), VAL_NUM(i), map->array[i]));
+    }
+
+    // Setting a key never runs code, so the map stays as it is.
+    for (int i = 0; i < map->dict.used; i++) {
+        entry_t *entry = &map->dict.entries[i];
+        if (entry->keyType == VT_NIL) continue;
+
+        vm->top[-1] = VAL_OBJ(pmap_set(vm, AS_PMAP(vm->top[-1]),
+            dict_key(entry), dict_value(entry)));
+    }
+
+    return vm_pop(vm);
+}
+
+// set(pmap, key, value) is a new version with the key set, or removed
+// when the value is nil. The pmap itself never changes.
+static val_t pmap_set_(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 2 || !IS_PMAP(args[0]) || !isKey(args[1])) return VAL_NIL;
+
+    if (IS_STRING(args[1])) str_key(vm, &args[1]);
+
+    val_t value = argc > 2 ? args[2] : VAL_NIL;
+    return VAL_OBJ(pmap_set(vm, AS_PMAP(args[0]), args[1], value));
+}
+
+static val_t pmap_remove(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 2 || !IS_PMAP(args[0]) || !isKey(args[1])) return VAL_NIL;
+
+    if (IS_STRING(args[1])) str_key(vm, &args[1]);
+
+    return VAL_OBJ(pmap_set(vm, AS_PMAP(args[0]), args[1], VAL_NIL));
+}
+
+static val_t pmap_len(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 1 || !IS_PMAP(args[0])) return VAL_NIL;
+
+    return VAL_NUM(AS_PMAP(args[0])->count);
+}
+
+void load_libpmap(vm_t *vm)
+{
+    map_t *pmap = map_new(vm, 0, 0);
+
+    map_set(vm, pmap, "new", VAL_CFN(pmap_new_));
+    map_set(vm, pmap, "set", VAL_CFN(pmap_set_));
+    map_set(vm, pmap, "remove", VAL_CFN(pmap_remove));
+    map_set(vm, pmap, "len", VAL_CFN(pmap_len));
+
+    set_global(vm, "pmap", VAL_OBJ(pmap));
+}
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "libs.h"
+#include "vm.h"
+#include "object.h"
+
+static val_t strbuf_new(vm_t *vm, int argc, val_t *args)
+{
+    int capacity = (argc > 0 && IS_NUM(args[0])) ? AS_INT(args[0]) : 0;
+    if (capacity < 0) capacity = 0;
+
+    return VAL_OBJ(buf_new(vm, capacity));
+}
+
+static val_t strbuf_append(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 1 || !IS_BUF(args[0])) return VAL_NIL;
+    buf_t *buf = AS_BUF(args[0]);
+
+    for (int i = 1; i < argc; i++) {
+        char number[32];
+
+        switch (AS_TYPE(args[i])) {
+            case VT_NIL:
+                buf_append(vm, buf, "nil", 3);
+                break;
+            case VT_BOOL:
+                if (AS_BOOL(args[i])) buf_append(vm, buf, "true", 4);
+                else buf_append(vm, buf, "false", 5);
+                break;
+            case VT_NUM: {
+                int length = snprintf(number, sizeof(number), "%.14g", AS_NUM(args[i]));
+                buf_append(vm, buf, number, length);
+                break;
+            }
+            case VT_OBJ:
+                if (IS_STRING(args[i])) {
+                    if (IS_ROPE(args[i])) str_flatten(vm, &args[i]);
+                    obj_t *string = AS_OBJ(args[i]);
+                    buf_append(vm, buf, str_view(string), str_length(string));
+                }
+                else if (IS_BUF(args[i])) {
+                    buf_t *other = AS_BUF(args[i]);
+                    buf_append(vm, buf, other->chars, other->length);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    return args[0];
+}
+
+static val_t strbuf_tostr(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 1 || !IS_BUF(args[0])) return VAL_NIL;
+    buf_t *buf = AS_BUF(args[0]);
+    str_t *string = str_new(vm, buf->length);
+
+    if (buf->length > 0) memcpy(string->chars, buf->chars, buf->length);
+    return VAL_OBJ(string);
+}
+
+static val_t strbuf_len(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 1 || !IS_BUF(args[0])) return VAL_NIL;
+
+    return VAL_NUM(AS_BUF(args[0])->length);
+}
+
+static val_t strbuf_clear(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 1 || !IS_BUF(args[0])) return VAL_NIL;
+
+    AS_BUF(args[0])->length = 0;
+    return args[0];
+}
+
+void load_libstrbuf(vm_t *vm)
+{
+    map_t *strbuf = map_new(vm, 0, 0);
+
+    map_set(vm, strbuf, "new", VAL_CFN(strbuf_new));
+    map_set(vm, strbuf, "append", VAL_CFN(strbuf_append));
+    map_set(vm, strbuf, "tostr", VAL_CFN(strbuf_tostr));
+    map_set(vm, strbuf, "len", VAL_CFN(strbuf_len));
+    map_set(vm, strbuf, "clear", VAL_CFN(strbuf_clear));
+
+    set_global(vm, "strbuf", VAL_OBJ(strbuf));
+}
@@ -0,0 +1,429 @@
+#include <limits.h>
+#include <string.h>
+
+#include "libs.h"
+#include "vm.h"
+#include "object.h"
+
+#ifdef HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+typedef enum {
+    CC_DIGIT,
+    CC_ALPHA,
+    CC_ALNUM,
+    CC_SPACE,
+    CC_UPPER,
+    CC_LOWER
+} cclass_t;
+
+static bool inClass(uint8_t c, cclass_t cls)
+{
+    switch (cls) {
+        case CC_DIGIT: return c >= '0' && c <= '9';
+        case CC_ALPHA: return (c | 0x20) >= 'a' && (c | 0x20) <= 'z';
+        case CC_ALNUM: return inClass(c, CC_DIGIT) || inClass(c, CC_ALPHA);
+        case CC_SPACE: return c == ' ' || (c >= '\t' && c <= '\r');
+        case CC_UPPER: return c >= 'A' && c <= 'Z';
+        case CC_LOWER: return c >= 'a' && c <= 'z';
+    }
+    return false;
+}
+
+#ifdef HAS_SSE2
+// Bytes at or above 0x80 compare as negative, so they never fall in
+// one of these ASCII ranges.
+static inline __m128i inRange(__m128i x, char lo, char hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(lo - 1)),
+        _mm_cmplt_epi8(x, _mm_set1_epi8(hi + 1)));
+}
+
+static inline __m128i classify(__m128i x, cclass_t cls)
+{
+    switch (cls) {
+        case CC_DIGIT: return inRange(x, '0', '9');
+        case CC_ALPHA: return inRange(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z');
+        case CC_ALNUM: return _mm_or_si128(classify(x, CC_DIGIT), classify(x, CC_ALPHA));
+        case CC_SPACE: return _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                           inRange(x, '\t', '\r'));
+        case CC_UPPER: return inRange(x, 'A', 'Z');
+        case CC_LOWER: return inRange(x, 'a', 'z');
+    }
+    return _mm_setzero_si128();
+}
+#endif
+
+static bool allOf(const char *chars, size_t length, cclass_t cls)
+{
+    size_t i = 0;
+
+#ifdef HAS_SSE2
+    for (; i + 16 <= length; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(chars + i));
+        if (_mm_movemask_epi8(classify(x, cls)) != 0xFFFF) return false;
+    }
+#endif
+
+    for (; i < length; i++) {
+        if (!inClass((uint8_t)chars[i], cls)) return false;
+    }
+
+    return true;
+}
+
+// Flip the case of the bytes in the range lo-hi, ASCII only.
+static void mapCase(char *dest, const char *chars, size_t length, char lo, char hi)
+{
+    size_t i = 0;
+
+#ifdef HAS_SSE2
+    __m128i flip = _mm_set1_epi8(0x20);
+    for (; i + 16 <= length; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(chars + i));
+        x = _mm_xor_si128(x, _mm_and_si128(inRange(x, lo, hi), flip));
+        _mm_storeu_si128((__m128i *)(dest + i), x);
+    }
+#endif
+
+    for (; i < length; i++) {
+        char c = chars[i];
+        dest[i] = (c >= lo && c <= hi) ? (c ^ 0x20) : c;
+    }
+}
+
+// Find needle in haystack. Matching the first and the last byte of the
+// needle over 16 positions at once leaves few candidates for memcmp.
+static const char *findStr(const char *haystack, size_t length, const char *needle, size_t size)
+{
+    if (size == 0) return haystack;
+    if (size > length) return NULL;
+    if (size == 1) return memchr(haystack, needle[0], length);
+
+    size_t i = 0;
+    size_t last = length - size;
+
+#ifdef HAS_SSE2
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i final = _mm_set1_epi8(needle[size - 1]);
+
+    for (; i + 16 <= last + 1; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(haystack + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(haystack + i + size - 1));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, final)));
+
+        for (; mask != 0; mask &= mask - 1) {
+            size_t at = i + bit_first(mask);
+            if (memcmp(haystack + at + 1, needle + 1, size - 2) == 0) return haystack + at;
+        }
+    }
+#endif
+
+    while (i <= last) {
+        const char *at = memchr(haystack + i, needle[0], last - i + 1);
+        if (at == NULL) return NULL;
+
+        if (memcmp(at + 1, needle + 1, size - 1) == 0) return at;
+        i = at - haystack + 1;
+    }
+
+    return NULL;
+}
+
+static int countStr(const char *haystack, size_t length, const char *needle, size_t size)
+{
+    int count = 0;
+    const char *end = haystack + length;
+
+    for (;;) {
+        const char *at = findStr(haystack, end - haystack, needle, size);
+        if (at == NULL) return count;
+
+        count++;
+        haystack = at + size;
+    }
+}
+
+typedef struct {
+    obj_t *object;
+    const char *chars;
+    int length;
+} view_t;
+
+// Strings and slices are used in place, only ropes get flattened.
+static bool checkStr(vm_t *vm, int argc, val_t *args, int i, view_t *view)
+{
+    if (i >= argc || !IS_STRING(args[i])) return false;
+    if (IS_ROPE(args[i])) str_flatten(vm, &args[i]);
+
+    view->object = AS_OBJ(args[i]);
+    view->chars = str_view(view->object);
+    view->length = str_length(view->object);
+    return true;
+}
+
+// Clamp a character index, negative ones count from the end.
+static int clampIndex(int argc, val_t *args, int i, int fallback, obj_t *string)
+{
+    if (i >= argc || !IS_NUM(args[i])) return fallback;
+
+    int index = AS_INT(args[i]);
+    int length = str_runes(string);
+
+    if (index < 0) index += length;
+    if (index < 0) return 0;
+    if (index > length) return length;
+    return index;
+}
+
+static val_t string_len(vm_t *vm, int argc, val_t *args)
+{
+    view_t string;
+    if (!checkStr(vm, argc, args, 0, &string)) return VAL_NIL;
+
+    return VAL_NUM(str_runes(string.object));
+}
+
+static val_t string_find(vm_t *vm, int argc, val_t *args)
+{
+    view_t string, needle;
+    if (!checkStr(vm, argc, args, 0, &string) || !checkStr(vm, argc, args, 1, &needle))
+        return VAL_NIL;
+
+    int start = str_offset(string.object, clampIndex(argc, args, 2, 0, string.object));
+    const char *at = findStr(string.chars + start, string.length - start,
+        needle.chars, needle.length);
+
+    return VAL_NUM(at != NULL ? str_index(string.object, (int)(at - string.chars)) : -1);
+}
+
+static val_t string_count(vm_t *vm, int argc, val_t *args)
+{
+    view_t string, needle;
+    if (!checkStr(vm, argc, args, 0, &string) || !checkStr(vm, argc, args, 1, &needle)
+        || needle.length == 0) return VAL_NIL;
+
+    return VAL_NUM(countStr(string.chars, string.length, needle.chars, needle.length));
+}
+
+static void pushPart(vm_t *vm, map_t *list, int index, val_t *string, const char *chars, int length)
+{
+    int start = (int)(chars - str_view(AS_OBJ(*string)));
+
+    vm_push(vm, VAL_OBJ(str_slice(vm, string, start, length)));
+    map_seti(vm, list, index, vm->top[-1]);
+    vm_pop(vm);
+}
+
+static val_t string_split(vm_t *vm, int argc, val_t *args)
+{
+    view_t string, sep;
+    if (!checkStr(vm, argc, args, 0, &string)) return VAL_NIL;
+
+    bool hasSep = checkStr(vm, argc, args, 1, &sep);
+    if (hasSep && sep.length == 0) return VAL_NIL;
+
+    map_t *list = map_new(vm, 0, 0);
+    vm_push(vm, VAL_OBJ(list));
+
+    // The fields are slices of the string, none of it is copied.
+    const char *chars = string.chars;
+    const char *end = chars + string.length;
+    int count = 0;
+
+    if (!hasSep) {
+        // Runs of whitespace, ignoring it at both ends.
+        for (;;) {
+            while (chars < end && inClass((uint8_t)*chars, CC_SPACE)) chars++;
+            if (chars == end) break;
+
+            const char *start = chars;
+            while (chars < end && !inClass((uint8_t)*chars, CC_SPACE)) chars++;
+            pushPart(vm, list, count++, &args[0], start, (int)(chars - start));
+        }
+    }
+    else {
+        for (;;) {
+            const char *at = findStr(chars, end - chars, sep.chars, sep.length);
+            if (at == NULL) break;
+
+            pushPart(vm, list, count++, &args[0], chars, (int)(at - chars));
+            chars = at + sep.length;
+        }
+        pushPart(vm, list, count++, &args[0], chars, (int)(end - chars));
+    }
+
+    vm_pop(vm);
+    return VAL_OBJ(list);
+}
+
+static val_t string_replace(vm_t *vm, int argc, val_t *args)
+{
+    view_t string, from, to;
+    if (!checkStr(vm, argc, args, 0, &string) || !checkStr(vm, argc, args, 1, &from)
+        || !checkStr(vm, argc, args, 2, &to) || from.length == 0) return VAL_NIL;
+
+    int count = countStr(string.chars, string.length, from.chars, from.length);
+    if (count == 0) return args[0];
+
+    int64_t length = string.length + (int64_t)count * (to.length - from.length);
+    if (length > INT_MAX) return VAL_NIL;
+
+    str_t *result = str_new(vm, (int)length);
+    const char *chars = string.chars;
+    const char *end = chars + string.length;
+    char *dest = result->chars;
+
+    for (int i = 0; i < count; i++) {
+        const char *at = findStr(chars, end - chars, from.chars, from.length);
+
+        memcpy(dest, chars, at - chars);
+        dest += at - chars;
+        memcpy(dest, to.chars, to.length);
+        dest += to.length;
+        chars = at + from.length;
+    }
+    memcpy(dest, chars, end - chars);
+
+    return VAL_OBJ(result);
+}
+
+static val_t string_sub(vm_t *vm, int argc, val_t *args)
+{
+    view_t string;
+    if (!checkStr(vm, argc, args, 0, &string)) return VAL_NIL;
+
+    int start = str_offset(string.object, clampIndex(argc, args, 1, 0, string.object));
+    int end = argc > 2 ? str_offset(string.object, clampIndex(argc, args, 2, 0, string.object))
+        : string.length;
+
+    if (start == 0 && end == string.length) return args[0];
+    if (end < start) end = start;
+
+    return VAL_OBJ(str_slice(vm, &args[0], start, end - start));
+}
+
+static val_t changeCase(vm_t *vm, int argc, val_t *args, char lo, char hi)
+{
+    view_t string;
+    if (!checkStr(vm, argc, args, 0, &string)) return VAL_NIL;
+
+    str_t *result = str_new(vm, string.length);
+    mapCase(result->chars, string.chars, string.length, lo, hi);
+    return VAL_OBJ(result);
+}
+
+static val_t string_upper(vm_t *vm, int argc, val_t *args)
+{
+    return changeCase(vm, argc, args, 'a', 'z');
+}
+
+static val_t string_lower(vm_t *vm, int argc, val_t *args)
+{
+    return changeCase(vm, argc, args, 'A', 'Z');
+}
+
+static val_t string_trim(vm_t *vm, int argc, val_t *args)
+{
+    view_t string;
+    if (!checkStr(vm, argc, args, 0, &string)) return VAL_NIL;
+
+    const char *start = string.chars;
+    const char *end = start + string.length;
+
+    while (start < end && inClass((uint8_t)*start, CC_SPACE)) start++;
+    while (end > start && inClass((uint8_t)end[-1], CC_SPACE)) end--;
+
+    if (end - start == string.length) return args[0];
+    return VAL_OBJ(str_slice(vm, &args[0], (int)(start - string.chars), (int)(end - start)));
+}
+
+// Counts bytes where len, find and sub count runes, so that it pairs
+// with char: a negative index counts from the last byte.
+static val_t string_byte(vm_t *vm, int argc, val_t *args)
+{
+    view_t string;
+    if (!checkStr(vm, argc, args, 0, &string)) return VAL_NIL;
+
+    int index = (argc > 1 && IS_NUM(args[1])) ? AS_INT(args[1]) : 0;
+    if (index < 0) index += string.length;
+    if (index < 0 || index >= string.length) return VAL_NIL;
+
+    return VAL_NUM((uint8_t)string.chars[index]);
+}
+
+static val_t string_char(vm_t *vm, int argc, val_t *args)
+{
+    str_t *result = str_new(vm, argc);
+
+    for (int i = 0; i < argc; i++) {
+        result->chars[i] = IS_NUM(args[i]) ? (char)AS_INT(args[i]) : '?';
+    }
+
+    return VAL_OBJ(result);
+}
+
+static val_t isClass(vm_t *vm, int argc, val_t *args, cclass_t cls)
+{
+    view_t string;
+    if (!checkStr(vm, argc, args, 0, &string)) return VAL_NIL;
+
+    return VAL_BOOL(string.length > 0 && allOf(string.chars, string.length, cls));
+}
+
+static val_t string_isdigit(vm_t *vm, int argc, val_t *args)
+{
+    return isClass(vm, argc, args, CC_DIGIT);
+}
+
+static val_t string_isalpha(vm_t *vm, int argc, val_t *args)
+{
+    return isClass(vm, argc, args, CC_ALPHA);
+}
+
+static val_t string_isalnum(vm_t *vm, int argc, val_t *args)
+{
+    return isClass(vm, argc, args, CC_ALNUM);
+}
+
+static val_t string_isspace(vm_t *vm, int argc, val_t *args)
+{
+    return isClass(vm, argc, args, CC_SPACE);
+}
+
+static val_t string_isupper(vm_t *vm, int argc, val_t *args)
+{
+    return isClass(vm, argc, args, CC_UPPER);
+}
+
+static val_t string_islower(vm_t *vm, int argc, val_t *args)
+{
+    return isClass(vm, argc, args, CC_LOWER);
+}
+
+void load_libstring(vm_t *vm)
+{
+    map_t *string = map_new(vm, 0, 0);
+
+    map_set(vm, string, "len", VAL_CFN(string_len));
+    map_set(vm, string, "find", VAL_CFN(string_find));
+    map_set(vm, string, "count", VAL_CFN(string_count));
+    map_set(vm, string, "split", VAL_CFN(string_split));
+    map_set(vm, string, "replace", VAL_CFN(string_replace));
+    map_set(vm, string, "sub", VAL_CFN(string_sub));
+    map_set(vm, string, "upper", VAL_CFN(string_upper));
+    map_set(vm, string, "lower", VAL_CFN(string_lower));
+    map_set(vm, string, "trim", VAL_CFN(string_trim));
+    map_set(vm, string, "byte", VAL_CFN(string_byte));
+    map_set(vm, string, "char", VAL_CFN(string_char));
+    map_set(vm, string, "isdigit", VAL_CFN(string_isdigit));
+    map_set(vm, string, "isalpha", VAL_CFN(string_isalpha));
+    map_set(vm, string, "isalnum", VAL_CFN(string_isalnum));
+    map_set(vm, string, "isspace", VAL_CFN(string_isspace));
+    map_set(vm, string, "isupper", VAL_CFN(string_isupper));
+    map_set(vm, string, "islower", VAL_CFN(string_islower));
+
+    set_global(vm, "string", VAL_OBJ(string));
+}
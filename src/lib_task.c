@@ -0,0 +1,41 @@
+#include "libs.h"
+#include "vm.h"
+#include "object.h"
+#include "task.h"
+
+// spawn(fn, args...) queues the call for the pool and returns its future,
+// nil when an argument is a map or another value that can't be shared.
+static val_t task_spawn(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 1 || vm->pool == NULL) return VAL_NIL;
+    if (!IS_FUN(args[0]) && !IS_CFN(args[0])) return VAL_NIL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!obj_shareable(args[i])) return VAL_NIL;
+    }
+
+    future_t *future = future_new(vm, args, argc - 1);
+    pool_spawn(vm->pool, future);
+    return VAL_OBJ(future);
+}
+
+// await(future) returns the result of the call, nil if it failed or
+// returned a map. Any other value is its own result.
+static val_t task_await(vm_t *vm, int argc, val_t *args)
+{
+    if (argc < 1) return VAL_NIL;
+    if (!IS_FUTURE(args[0]) || vm->pool == NULL) return args[0];
+
+    return pool_await(vm, AS_FUTURE(args[0]));
+}
+
+void load_libtask(vm_t *vm)
+{
+    map_t *task = map_new(vm, 0, 0);
+
+    map_set(vm, task, "spawn", VAL_CFN(task_spawn));
+    map_set(vm, task, "await", VAL_CFN(task_await));
+
+    vm->pool = pool_new(vm);
+    set_global(vm, "task", VAL_OBJ(task));
+}
@@ -1,147 +1,239 @@
 #include <stdlib.h>
 
-#ifdef _WIN32
-#include <windows.h>
-#else
-#include <unistd.h>
-#include <pthread.h>
-#endif
-
 #include "libs.h"
 #include "vm.h"
 #include "value.h"
+#include "object.h"
+#include "sync.h"
+#include "thread.h"
+
+// Sleeps are cut in slices this long to notice a cancel.
+#define SLEEP_SLICE_MS  10
+
+threads_t *threads_new()
+{
+    threads_t *threads = malloc(sizeof(threads_t));
+    if (threads == NULL) return NULL;
+
+    mutex_init(&threads->lock);
+    threads->head = NULL;
+    return threads;
+}
+
+// Whoever takes a thread from running joins it, joining twice is an
+// error.
+static bool claim(threads_t *threads, thread_t *thread)
+{
+    mutex_lock(&threads->lock);
+    bool running = thread->running;
+    thread->running = false;
+    mutex_unlock(&threads->lock);
+    return running;
+}
+
+// False when the registry is being freed, it closes the thread then.
+static bool forget(threads_t *threads, thread_t *thread)
+{
+    mutex_lock(&threads->lock);
+
+    thread_t **link = &threads->head;
+    while (*link != NULL && *link != thread) link = &(*link)->next;
+
+    bool found = *link != NULL;
+    if (found) *link = thread->next;
+
+    mutex_unlock(&threads->lock);
+    return found;
+}
 
-typedef struct {
-    vm_t *vm;
-    vm_t *main;
-    fun_t *routine;
-#ifdef _WIN32
-    HANDLE handle;
-#else
-    // todo
-#endif
-    bool running;
-} thread_t;
-
-#ifdef _WIN32
-static DWORD WINAPI thread_routine(void *data)
-#else
-#endif
+void threads_halt(threads_t *threads)
+{
+    if (threads == NULL) return;
+
+    mutex_lock(&threads->lock);
+    for (thread_t *thread = threads->head; thread != NULL; thread = thread->next) {
+        atomic_store(&thread->vm->halt, true);
+    }
+    mutex_unlock(&threads->lock);
+}
+
+void threads_free(threads_t *threads)
+{
+    if (threads == NULL) return;
+
+    mutex_lock(&threads->lock);
+    thread_t *head = threads->head;
+    threads->head = NULL;
+    mutex_unlock(&threads->lock);
+
+    // All joined before any is closed, one may be joining another.
+    for (thread_t *thread = head; thread != NULL; thread = thread->next) {
+        atomic_store(&thread->vm->halt, true);
+        if (claim(threads, thread)) os_thread_join(thread->handle);
+    }
+
+    while (head != NULL) {
+        thread_t *next = head->next;
+        vm_close(head->vm);
+        free(head);
+        head = next;
+    }
+
+    mutex_destroy(&threads->lock);
+    free(threads);
+}
+
+static OS_THREAD_ROUTINE(thread_routine)
 {
     thread_t *thread = data;
+    vm_t *vm = thread->vm;
 
-    vm_call(thread->vm, VAL_OBJ(thread->routine), 0);
-    vm_execute(thread->vm);
+    gc_enter(vm->gc, vm);
+
+    if (vm_call(vm, thread->routine, thread->argCount)) {
+        thread->status = vm_execute(vm);
+        if (thread->status == VM_OK && obj_shareable(vm->top[-1])) {
+            thread->result = vm->top[-1];
+        }
+    }
 
+    gc_leave(vm->gc);
     return 0;
 }
 
+// The caller leaves the heap meanwhile, the thread may want to collect.
+static void waitThread(vm_t *vm, thread_t *thread)
+{
+    if (!claim(vm->threads, thread)) return;
+
+    gc_leave(vm->gc);
+    os_thread_join(thread->handle);
+    gc_enter(vm->gc, vm);
+}
+
 static val_t thread_sleep(vm_t *vm, int argc, val_t *args)
 {
+    if (argc < 1 || !IS_NUM(args[0])) return VAL_NIL;
+
     int ms = AS_INT(args[0]);
+    gc_leave(vm->gc);
 
-#ifdef _WIN32
-    Sleep(ms);
-#else
-    usleep(ms * 1000);
-#endif
+    while (ms > 0 && !atomic_load(&vm->halt)) {
+        int slice = ms < SLEEP_SLICE_MS ? ms : SLEEP_SLICE_MS;
+        os_sleep(slice);
+        ms -= slice;
+    }
 
+    gc_enter(vm->gc, vm);
     return VAL_NIL;
 }
 
+// create(routine) prepares a thread with its own stack, start runs it.
 static val_t thread_create(vm_t *vm, int argc, val_t *args)
 {
+    if (argc < 1 || !IS_FUN(args[0]) || vm->threads == NULL) return VAL_NIL;
+
     thread_t *thread = malloc(sizeof(thread_t));
-    thread->main = vm;
+    if (thread == NULL) return VAL_NIL;
+
     thread->vm = vm_clone(vm);
-    thread->running = false;
-    thread->routine = AS_FUN(args[0]);
+    if (thread->vm == NULL) {
+        free(thread);
+        return VAL_NIL;
+    }
 
-    vm_push(thread->vm, args[0]);
+    thread->main = vm;
+    thread->routine = args[0];
+    thread->argCount = 0;
+    thread->started = false;
+    thread->running = false;
+    thread->status = VM_RUNTIME_ERROR;
+    thread->result = VAL_NIL;
 
-#ifdef _WIN32
-    thread->handle = CreateThread(NULL, 0, thread_routine, thread, CREATE_SUSPENDED, NULL);
-#else
-#endif
+    mutex_lock(&vm->threads->lock);
+    thread->next = vm->threads->head;
+    vm->threads->head = thread;
+    mutex_unlock(&vm->threads->lock);
 
+    vm_push(thread->vm, args[0]);
     return VAL_PTR(thread);
 }
 
+// exit() stops the calling script at once, a thread ends as cancelled.
 static val_t thread_exit(vm_t *vm, int argc, val_t *args)
 {
-#ifdef _WIN32
-    ExitThread(0);
-#else
-#endif
-
+    atomic_store(&vm->halt, true);
     return VAL_NIL;
 }
 
+// start(thread, args...) calls the routine with the arguments on its own
+// OS thread. Maps and other values that can't be shared aren't accepted.
 static val_t thread_start(vm_t *vm, int argc, val_t *args)
 {
+    if (argc < 1 || !IS_PTR(args[0])) return VAL_FALSE;
     thread_t *thread = AS_PTR(args[0]);
 
-    if (!thread->running) {
-        for (int i = 0; i < argc; i++) {
-            //vm_push(thread->vm, args[i]);
-        }
+    // A thread runs once.
+    if (thread->started) return VAL_FALSE;
 
-        thread->running = true;
+    for (int i = 1; i < argc; i++) {
+        if (!obj_shareable(args[i])) return VAL_FALSE;
+    }
 
-#ifdef _WIN32
-        ResumeThread(thread->handle);
-#else
-#endif
+    for (int i = 1; i < argc; i++) {
+        vm_push(thread->vm, args[i]);
     }
+    thread->argCount = argc - 1;
 
-    return VAL_NIL;
+    // Locked, so that a script ending meanwhile sees it running.
+    mutex_lock(&vm->threads->lock);
+    thread->running = os_thread_create(&thread->handle, thread_routine, thread);
+    mutex_unlock(&vm->threads->lock);
+
+    if (!thread->running) {
+        thread->vm->top -= thread->argCount;
+        return VAL_FALSE;
+    }
+
+    thread->started = true;
+    return VAL_TRUE;
 }
 
+// join(thread) waits for the routine and returns its result, nil when
+// it failed, was cancelled or returned a map.
 static val_t thread_join(vm_t *vm, int argc, val_t *args)
 {
+    if (argc < 1 || !IS_PTR(args[0])) return VAL_NIL;
     thread_t *thread = AS_PTR(args[0]);
 
-    if (thread->running) {
-#ifdef _WIN32
-        WaitForSingleObject(thread->handle, INFINITE);
-#else
-#endif
-    }
-
-    return VAL_NIL;
+    waitThread(vm, thread);
+    return thread->result;
 }
 
+// cancel(thread) asks the routine to stop. It does so at its next call
+// or within a sleep, never in the middle of an allocation, and join
+// still has to be called.
 static val_t thread_cancel(vm_t *vm, int argc, val_t *args)
 {
+    if (argc < 1 || !IS_PTR(args[0])) return VAL_NIL;
     thread_t *thread = AS_PTR(args[0]);
 
-    if (!thread->running) {
-#ifdef _WIN32
-        TerminateThread(thread->handle, 0);
-#else
-#endif
-    }
-
+    atomic_store(&thread->vm->halt, true);
     return VAL_NIL;
 }
 
 static val_t thread_close(vm_t *vm, int argc, val_t *args)
 {
+    if (argc < 1 || !IS_PTR(args[0])) return VAL_NIL;
     thread_t *thread = AS_PTR(args[0]);
 
-    if (thread->running) {
-#ifdef _WIN32
-        TerminateThread(thread->handle, 0);
-#else
-#endif
-    }
+    atomic_store(&thread->vm->halt, true);
+    waitThread(vm, thread);
 
-#ifdef _WIN32
-    CloseHandle(thread->handle);
-#else
-#endif
+    // Once the script is ending, threads_free closes it instead.
+    if (!forget(vm->threads, thread)) return VAL_NIL;
 
-    free(thread->vm);
+    vm_close(thread->vm);
     free(thread);
     return VAL_NIL;
 }
@@ -158,5 +250,6 @@ void load_libthread(vm_t *vm)
     map_set(vm, thread, "cancel", VAL_CFN(thread_cancel));
     map_set(vm, thread, "close", VAL_CFN(thread_close));
 
+    vm->threads = threads_new();
     set_global(vm, "thread", VAL_OBJ(thread));
 }
@@ -5,3 +5,10 @@
 
 void load_libmath(vm_t *vm);
 void load_libthread(vm_t *vm);
+void load_libgc(vm_t *vm);
+void load_libstrbuf(vm_t *vm);
+void load_libstring(vm_t *vm);
+void load_libf64array(vm_t *vm);
+void load_libpmap(vm_t *vm);
+void load_libtask(vm_t *vm);
+void load_libchannel(vm_t *vm);
@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "vm.h"
 #include "libs.h"
@@ -6,7 +8,7 @@
 int main(int argc, char **argv)
 {
     if (argc < 2) {
-        printf("usage: lox [file]\n");
+        printf("usage: lox [-m megabytes] [file]\n");
         return 0;
     }
 
@@ -14,8 +16,19 @@ int main(int argc, char **argv)
     int ret = VM_INIT_ERROR;
 
     if (vm != NULL) {
+        if (argc > 3 && strcmp(argv[1], "-m") == 0) {
+            vm->gc->limit = (size_t)(atof(argv[2]) * 1024 * 1024);
+        }
+
         load_libmath(vm);
         load_libthread(vm);
+        load_libgc(vm);
+        load_libstrbuf(vm);
+        load_libstring(vm);
+        load_libf64array(vm);
+        load_libpmap(vm);
+        load_libtask(vm);
+        load_libchannel(vm);
         ret = vm_dofile(vm, argv[argc - 1]);
         vm_close(vm);
     }
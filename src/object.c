@@ -5,63 +5,346 @@
 #include "object.h"
 #include "vm.h"
 #include "gc.h"
-
-#define ALLOC(gc, size) \
-    gc_realloc(gc, NULL, 0, size)
-
-#define FREE(gc, type, pointer) \
-    gc_realloc(gc, pointer, sizeof(type), 0)
+#include "channel.h"
 
 #define ALLOC_OBJ(vm, type, objectType) \
-    (type *)allocateObject(vm, sizeof(type), objectType)
+    (type *)obj_alloc(vm, sizeof(type), objectType)
 
-static obj_t *allocateObject(vm_t *vm, size_t size, otype_t type)
+obj_t *obj_alloc(vm_t *vm, size_t size, otype_t type)
 {
     gc_t *gc = vm->gc;
 
     obj_t *object = ALLOC(gc, size);
     object->type = type;
+    object->marked = false;
 
-    object->next = gc->objects;
-    gc->objects = object;
+    gc_track(gc, object);
     return object;
 }
 
-static str_t *allocateString(vm_t *vm, char *chars, int length, uint32_t hash)
+// Another thread may have interned the same characters meanwhile, then
+// its string wins and this one is left to the collector.
+// A string left out of the table would compare unequal to its copies,
+// so running out of memory here raises once the shard is unlocked.
+static str_t *internString(vm_t *vm, str_t *string)
 {
-    str_t *string = ALLOC_OBJ(vm, str_t, OT_STR);
-    string->length = length;
-    string->chars = chars;
-    string->hash = hash;
+    str_t *interned = intern_add(vm->strings, string);
+    if (interned == NULL) vm_nomem(vm->gc);
+    return interned;
+}
 
-    tab_set(vm->strings, string, VAL_NIL);
+str_t *str_new(vm_t *vm, int length)
+{
+    str_t *string = (str_t *)obj_alloc(vm, STR_SIZE(length), OT_STR);
+    string->length = length;
+    atomic_init(&string->hash, 0);
+    atomic_init(&string->interned, false);
+    atomic_init(&string->ascii, ASCII_UNKNOWN);
+    string->chars[length] = '\0';
 
     return string;
 }
 
-str_t *str_take(vm_t *vm, char *chars, int length)
+str_t *str_intern(vm_t *vm, str_t *string)
 {
-    uint32_t hash = hash_bytes(chars, length);
-    str_t *interned = tab_findstr(vm->strings, chars, length, hash);
-    if (interned != NULL) {
-        free(chars);
-        return interned;
+    if (string->interned) return string;
+
+    // Computed strings are hashed once, on their first use as a key.
+    uint32_t hash = atomic_load_explicit(&string->hash, memory_order_relaxed);
+    if (hash == 0) {
+        hash = hash_bytes(string->chars, string->length);
+        atomic_store_explicit(&string->hash, hash, memory_order_relaxed);
     }
 
-    return allocateString(vm, chars, length, hash);
+    str_t *interned = intern_find(vm->strings, string->chars, string->length, hash);
+    if (interned != NULL) return interned;
+
+    return internString(vm, string);
 }
 
 str_t *str_copy(vm_t *vm, const char *chars, int length)
 {
     uint32_t hash = hash_bytes(chars, length);
-    str_t *interned = tab_findstr(vm->strings, chars, length, hash);
+    str_t *interned = intern_find(vm->strings, chars, length, hash);
     if (interned != NULL) return interned;
 
-    char *heapChars = malloc((length + 1) * sizeof(char));
-    memcpy(heapChars, chars, length);
-    heapChars[length] = '\0';
+    str_t *string = str_new(vm, length);
+    memcpy(string->chars, chars, length);
+    atomic_init(&string->hash, hash);
+
+    return internString(vm, string);
+}
+
+str_t *str_flatten(vm_t *vm, val_t *slot)
+{
+    if (IS_ROPE(*slot)) {
+        *slot = VAL_OBJ(rope_flatten(vm, AS_ROPE(*slot)));
+    }
+    else if (IS_SLICE(*slot)) {
+        *slot = VAL_OBJ(slice_flatten(vm, AS_SLICE(*slot)));
+    }
+
+    return AS_STR(*slot);
+}
+
+str_t *str_key(vm_t *vm, val_t *slot)
+{
+    if (IS_SLICE(*slot) && slice_flat(AS_SLICE(*slot)) == NULL) {
+        // The key is often interned already, then there's nothing to copy.
+        slice_t *slice = AS_SLICE(*slot);
+        uint32_t hash = hash_bytes(slice->chars, slice->length);
+
+        str_t *interned = intern_find(vm->strings, slice->chars, slice->length, hash);
+        if (interned != NULL) {
+            *slot = VAL_OBJ(interned);
+            return interned;
+        }
+
+        atomic_store_explicit(&slice_flatten(vm, slice)->hash, hash, memory_order_relaxed);
+    }
+
+    str_t *string = str_flatten(vm, slot);
+
+    if (!string->interned) {
+        string = str_intern(vm, string);
+        *slot = VAL_OBJ(string);
+    }
+
+    return string;
+}
+
+obj_t *str_slice(vm_t *vm, val_t *slot, int start, int length)
+{
+    obj_t *source = IS_ROPE(*slot) ? (obj_t *)str_flatten(vm, slot) : AS_OBJ(*slot);
+    const char *chars = str_view(source) + start;
+
+    if (length < SLICE_MIN_LENGTH) {
+        str_t *string = str_new(vm, length);
+        memcpy(string->chars, chars, length);
+        return (obj_t *)string;
+    }
+
+    // Always share the underlying string, never a chain of slices.
+    str_t *parent;
+    uint8_t ascii;
+
+    if (source->type == OT_SLICE) {
+        slice_t *from = (slice_t *)source;
+        str_t *flat = slice_flat(from);
+        parent = flat != NULL ? flat : from->parent;
+        ascii = atomic_load_explicit(&from->ascii, memory_order_relaxed);
+
+        // Only the collector moves a flattened slice onto its copy.
+        if (flat != NULL) chars = flat->chars + (chars - from->chars);
+    }
+    else {
+        parent = (str_t *)source;
+        ascii = atomic_load_explicit(&parent->ascii, memory_order_relaxed);
+    }
+
+    slice_t *slice = ALLOC_OBJ(vm, slice_t, OT_SLICE);
+    slice->length = length;
+    atomic_init(&slice->ascii, ascii == ASCII_YES ? ASCII_YES : ASCII_UNKNOWN);
+    slice->chars = chars;
+    slice->parent = parent;
+    atomic_init(&slice->flat, NULL);
+    return (obj_t *)slice;
+}
+
+// Publishes a flattened copy, or drops it for the one another thread
+// published first. The release pairs with the acquire in rope_flat and
+// slice_flat, a reader sees the characters filled in.
+static str_t *publishFlat(_Atomic(str_t *) *flat, str_t *string)
+{
+    str_t *first = NULL;
+    if (atomic_compare_exchange_strong_explicit(flat, &first, string,
+            memory_order_release, memory_order_acquire)) {
+        return string;
+    }
+    return first;
+}
+
+str_t *slice_flatten(vm_t *vm, slice_t *slice)
+{
+    str_t *flat = slice_flat(slice);
+    if (flat != NULL) return flat;
+
+    vm_push(vm, VAL_OBJ(slice));
+    str_t *string = str_new(vm, slice->length);
+    memcpy(string->chars, slice->chars, slice->length);
+    atomic_init(&string->ascii, atomic_load_explicit(&slice->ascii, memory_order_relaxed));
+    vm_pop(vm);
 
-    return allocateString(vm, heapChars, length, hash);
+    return publishFlat(&slice->flat, string);
+}
+
+#define IS_CONTINUATION(c)  (((c) & 0xC0) == 0x80)
+
+bool str_ascii(obj_t *object)
+{
+    _Atomic uint8_t *flag = object->type == OT_STR
+        ? &((str_t *)object)->ascii : &((slice_t *)object)->ascii;
+    uint8_t ascii = atomic_load_explicit(flag, memory_order_relaxed);
+
+    if (ascii == ASCII_UNKNOWN) {
+        ascii = bytes_ascii(str_view(object), str_length(object)) ? ASCII_YES : ASCII_NO;
+        atomic_store_explicit(flag, ascii, memory_order_relaxed);
+    }
+
+    return ascii == ASCII_YES;
+}
+
+int str_runes(obj_t *object)
+{
+    int length = str_length(object);
+    if (str_ascii(object)) return length;
+
+    const char *chars = str_view(object);
+    int count = 0;
+
+    for (int i = 0; i < length; i++) {
+        if (!IS_CONTINUATION(chars[i])) count++;
+    }
+
+    return count;
+}
+
+// Byte offset of the character at index, or the length past the end.
+int str_offset(obj_t *object, int index)
+{
+    int length = str_length(object);
+    if (str_ascii(object)) return index < length ? index : length;
+
+    const char *chars = str_view(object);
+    int offset = 0;
+
+    for (; offset < length; offset++) {
+        if (!IS_CONTINUATION(chars[offset]) && index-- == 0) break;
+    }
+
+    return offset;
+}
+
+// Index of the character starting at a byte offset.
+int str_index(obj_t *object, int offset)
+{
+    if (str_ascii(object)) return offset;
+
+    const char *chars = str_view(object);
+    int index = 0;
+
+    for (int i = 0; i < offset; i++) {
+        if (!IS_CONTINUATION(chars[i])) index++;
+    }
+
+    return index;
+}
+
+static obj_t *ropePart(obj_t *object)
+{
+    // A flattened rope or slice is just its string now.
+    str_t *flat = NULL;
+    if (object->type == OT_ROPE) flat = rope_flat((rope_t *)object);
+    else if (object->type == OT_SLICE) flat = slice_flat((slice_t *)object);
+
+    return flat != NULL ? (obj_t *)flat : object;
+}
+
+rope_t *rope_new(vm_t *vm, obj_t *left, obj_t *right)
+{
+    rope_t *rope = ALLOC_OBJ(vm, rope_t, OT_ROPE);
+
+    rope->length = str_length(left) + str_length(right);
+    rope->left = ropePart(left);
+    rope->right = ropePart(right);
+    atomic_init(&rope->flat, NULL);
+    return rope;
+}
+
+str_t *rope_flatten(vm_t *vm, rope_t *rope)
+{
+    str_t *flat = rope_flat(rope);
+    if (flat != NULL) return flat;
+
+    vm_push(vm, VAL_OBJ(rope));
+    str_t *string = str_new(vm, rope->length);
+
+    // Fill from the end, walking right children first, so the usual
+    // left-deep rope built by appending needs no stack at all.
+    obj_t *local[32];
+    obj_t **stack = local;
+    int capacity = 32, count = 0;
+
+    char *end = string->chars + rope->length;
+    obj_t *node = (obj_t *)rope;
+
+    for (;;) {
+        node = ropePart(node);
+
+        if (node->type == OT_ROPE) {
+            if (count >= capacity) {
+                capacity *= 2;
+                obj_t **grown = stack == local ? malloc(capacity * sizeof(obj_t *))
+                    : realloc(stack, capacity * sizeof(obj_t *));
+
+                if (grown == NULL) {
+                    if (stack != local) free(stack);
+                    vm_nomem(vm->gc);
+                }
+
+                if (stack == local) memcpy(grown, local, sizeof(local));
+                stack = grown;
+            }
+
+            stack[count++] = ((rope_t *)node)->left;
+            node = ((rope_t *)node)->right;
+            continue;
+        }
+
+        int length = str_length(node);
+        end -= length;
+        memcpy(end, str_view(node), length);
+
+        if (count == 0) break;
+        node = stack[--count];
+    }
+
+    if (stack != local) free(stack);
+
+    vm_pop(vm);
+    return publishFlat(&rope->flat, string);
+}
+
+buf_t *buf_new(vm_t *vm, int capacity)
+{
+    buf_t *buf = ALLOC_OBJ(vm, buf_t, OT_BUF);
+
+    buf->length = 0;
+    buf->capacity = 0;
+    buf->chars = NULL;
+
+    if (capacity > 0) {
+        vm_push(vm, VAL_OBJ(buf));
+        buf->chars = ALLOC(vm->gc, capacity);
+        buf->capacity = capacity;
+        vm_pop(vm);
+    }
+
+    return buf;
+}
+
+void buf_append(vm_t *vm, buf_t *buf, const char *chars, int length)
+{
+    if (buf->length + length > buf->capacity) {
+        int capacity = GROW_CAPACITY(buf->capacity);
+        while (capacity < buf->length + length) capacity *= 2;
+
+        buf->chars = gc_realloc(vm->gc, buf->chars, buf->capacity, capacity);
+        buf->capacity = capacity;
+    }
+
+    memcpy(buf->chars + buf->length, chars, length);
+    buf->length += length;
 }
 
 fun_t *fun_new(vm_t *vm, src_t *source)
@@ -74,26 +357,210 @@ fun_t *fun_new(vm_t *vm, src_t *source)
     return function;
 }
 
-map_t *map_new(vm_t *vm, int arr_cap, int tab_cap)
+// The values are zeroed.
+f64array_t *f64array_new(vm_t *vm, int length)
+{
+    f64array_t *array = (f64array_t *)obj_alloc(vm, F64ARRAY_SIZE(length), OT_F64ARRAY);
+    array->length = length;
+    memset(array->values, 0, (size_t)length * sizeof(double));
+
+    return array;
+}
+
+static void resizeArray(vm_t *vm, map_t *map, int capacity)
+{
+    map->array = gc_realloc(vm->gc, map->array,
+        map->arrayCapacity * sizeof(val_t), capacity * sizeof(val_t));
+
+    for (int i = map->arrayCapacity; i < capacity; i++) {
+        map->array[i] = VAL_NIL;
+    }
+    map->arrayCapacity = capacity;
+}
+
+map_t *map_new(vm_t *vm, int arr_cap, int dict_cap)
 {
     map_t *map = ALLOC_OBJ(vm, map_t, OT_MAP);
 
-    hash_init(&map->hash);
-    tab_init(&map->table);
-    // todo
+    map->array = NULL;
+    map->arrayCapacity = 0;
+    map->arrayCount = 0;
+    dict_init(&map->dict, vm->gc);
+
+    if (arr_cap > 0 || dict_cap > 0) {
+        vm_push(vm, VAL_OBJ(map));
+        if (arr_cap > 0) resizeArray(vm, map, arr_cap);
+        if (dict_cap > 0) dict_reserve(&map->dict, dict_cap);
+        vm_pop(vm);
+    }
+
     return map;
 }
 
-void map_set(vm_t *vm, map_t *map, const char *key, val_t value)
+// A copy whose array part has arr_cap slots, from must have no array
+// keys past them.
+map_t *map_copy(vm_t *vm, map_t *from, int arr_cap)
 {
-    str_t *field = str_copy(vm, key, (int)strlen(key));
+    map_t *map = map_new(vm, arr_cap, 0);
+    int length = from->arrayCapacity < arr_cap ? from->arrayCapacity : arr_cap;
+
+    if (length > 0) memcpy(map->array, from->array, (size_t)length * sizeof(val_t));
+    map->arrayCount = from->arrayCount;
+
+    vm_push(vm, VAL_OBJ(map));
+    bool copied = dict_copy(&map->dict, &from->dict);
+    vm_pop(vm);
+
+    if (!copied) vm_nomem(vm->gc);
+    return map;
+}
+
+static int keyBucket(double key)
+{
+    int bucket = 0;
+    for (uint32_t n = (uint32_t)key; n != 0; n >>= 1) bucket++;
+    return bucket;
+}
+
+static bool isIndex(double key)
+{
+    return key >= 0 && key < (1 << 30) && (double)(int)key == key;
+}
+
+// The array size Lua would pick: the largest power of two that would
+// be more than half full with the integer keys of the map plus one more.
+static int arraySize(map_t *map, double key)
+{
+    int counts[32] = { 0 };
+
+    for (int i = 0; i < map->arrayCapacity; i++) {
+        if (!IS_NIL(map->array[i])) counts[keyBucket(i)]++;
+    }
+
+    for (int i = 0; i < map->dict.used; i++) {
+        entry_t *entry = &map->dict.entries[i];
+        if (entry->keyType != VT_NUM) continue;
+
+        double number = AS_NUM(dict_key(entry));
+        if (isIndex(number)) counts[keyBucket(number)]++;
+    }
+    counts[keyBucket(key)]++;
+
+    int total = 0, size = 0;
+    for (int i = 0; i < 31; i++) {
+        total += counts[i];
+        if (total > (1 << i) / 2) size = 1 << i;
+    }
+
+    return size;
+}
+
+// Move the keys now covered by the array out of the dict, looked up one
+// by one as removing them may shrink the dict.
+static void migrate(vm_t *vm, map_t *map, int capacity)
+{
+    int from = map->arrayCapacity;
+    resizeArray(vm, map, capacity);
+
+    for (int i = from; i < capacity && map->dict.count > 0; i++) {
+        if (dict_get(&map->dict, VAL_NUM(i), &map->array[i])) {
+            dict_remove(&map->dict, VAL_NUM(i));
+            map->arrayCount++;
+        }
+    }
+}
+
+// Halve an array left less than a quarter full, its keys past the new
+// end go back to the dict.
+static void shrinkArray(vm_t *vm, map_t *map)
+{
+    int capacity = map->arrayCapacity;
+    while (capacity > 8 && map->arrayCount < capacity / 4) {
+        capacity /= 2;
+    }
+    if (capacity == map->arrayCapacity) return;
+
+    // Removing a key never raises, near the heap limit the array stays.
+    int moved = 0;
+    for (int i = capacity; i < map->arrayCapacity; i++) {
+        if (!IS_NIL(map->array[i])) moved++;
+    }
+    if (!dict_tryreserve(&map->dict, moved)) return;
+
+    for (int i = capacity; i < map->arrayCapacity; i++) {
+        if (IS_NIL(map->array[i])) continue;
+
+        dict_set(&map->dict, VAL_NUM(i), map->array[i]);
+        map->arrayCount--;
+    }
+
+    resizeArray(vm, map, capacity);
+}
+
+val_t map_geti(map_t *map, double key)
+{
+    val_t *slot = map_slot(map, key);
+    if (slot != NULL) return *slot;
+
+    val_t value = VAL_NIL;
+    dict_get(&map->dict, VAL_NUM(key), &value);
+    return value;
+}
+
+void map_seti(vm_t *vm, map_t *map, double key, val_t value)
+{
+    val_t *slot = map_slot(map, key);
+
+    if (IS_NIL(value)) {
+        // Setting a key to nil removes it.
+        if (slot == NULL) {
+            dict_remove(&map->dict, VAL_NUM(key));
+        }
+        else if (!IS_NIL(*slot)) {
+            *slot = VAL_NIL;
+            map->arrayCount--;
+            if (map->arrayCount < map->arrayCapacity / 4) shrinkArray(vm, map);
+        }
+        return;
+    }
+
+    if (slot == NULL && isIndex(key)) {
+        // Appending grows the array, so does a dict about to grow which
+        // holds mostly integer keys.
+        int capacity = 0;
+
+        if (key == map->arrayCapacity)
+            capacity = map->arrayCapacity < 8 ? 8 : map->arrayCapacity * 2;
+        else if (dict_full(&map->dict))
+            capacity = arraySize(map, key);
+
+        if (capacity > map->arrayCapacity) {
+            migrate(vm, map, capacity);
+            slot = map_slot(map, key);
+        }
+    }
 
+    if (slot != NULL) {
+        if (IS_NIL(*slot)) map->arrayCount++;
+        *slot = value;
+    }
+    else {
+        dict_set(&map->dict, VAL_NUM(key), value);
+    }
+}
+
+void map_set(vm_t *vm, map_t *map, const char *key, val_t value)
+{
+    vm_push(vm, VAL_OBJ(map));
     vm_push(vm, value);
+
+    str_t *field = str_copy(vm, key, (int)strlen(key));
     vm_push(vm, VAL_OBJ(field));
-    tab_set(&map->table, field, value);
+    dict_set(&map->dict, VAL_OBJ(field), value);
 
     vm_pop(vm);
     vm_pop(vm);
+    vm_pop(vm);
 }
 
 const char *obj_typeof(obj_t *object)
@@ -103,11 +570,68 @@ const char *obj_typeof(obj_t *object)
             return "str";
         case OT_FUN:
             return "fn";
+        case OT_MAP:
+            return "map";
+        case OT_ROPE:
+            return "str";
+        case OT_BUF:
+            return "strbuf";
+        case OT_SLICE:
+            return "str";
+        case OT_F64ARRAY:
+            return "f64array";
+        case OT_PMAP:
+            return "pmap";
+        case OT_PNODE:
+            return "pnode";
+        case OT_FUTURE:
+            return "future";
+        case OT_CHANNEL:
+            return "channel";
         default:
             return "obj";
     }
 }
 
+size_t obj_size(obj_t *object)
+{
+    switch (object->type) {
+        case OT_STR: {
+            str_t *string = (str_t *)object;
+            return STR_SIZE(string->length);
+        }
+        case OT_FUN: {
+            fun_t *function = (fun_t *)object;
+            chunk_t *chunk = &function->chunk;
+            return sizeof(fun_t) + chunk->capacity * (sizeof(uint8_t) + sizeof(uint32_t))
+                + chunk->constants.capacity * sizeof(val_t);
+        }
+        case OT_MAP: {
+            map_t *map = (map_t *)object;
+            return sizeof(map_t) + map->arrayCapacity * sizeof(val_t)
+                + DICT_SIZE(map->dict.capacity);
+        }
+        case OT_ROPE:
+            return sizeof(rope_t);
+        case OT_BUF:
+            return sizeof(buf_t) + ((buf_t *)object)->capacity;
+        case OT_SLICE:
+            return sizeof(slice_t);
+        case OT_F64ARRAY:
+            return F64ARRAY_SIZE(((f64array_t *)object)->length);
+        case OT_PMAP:
+            return sizeof(pmap_t);
+        case OT_PNODE:
+            return PNODE_SIZE(((pnode_t *)object)->length);
+        case OT_FUTURE:
+            return FUTURE_SIZE(((future_t *)object)->argCount);
+        case OT_CHANNEL:
+            return CHANNEL_SIZE(((channel_t *)object)->capacity);
+        default:
+            return 0;
+    }
+}
+
 void obj_print(obj_t *object)
 {
     switch (object->type) {
@@ -127,6 +651,37 @@ void obj_print(obj_t *object)
         case OT_MAP:
             printf("map: %p", object);
             break;
+        case OT_F64ARRAY:
+            printf("f64array: %p", object);
+            break;
+        case OT_PMAP:
+            printf("pmap: %p", object);
+            break;
+        case OT_FUTURE:
+            printf("future: %p", object);
+            break;
+        case OT_CHANNEL:
+            printf("channel: %p", object);
+            break;
+        case OT_ROPE: {
+            // The VM flattens ropes before printing them.
+            str_t *flat = rope_flat((rope_t *)object);
+            if (flat != NULL)
+                obj_print((obj_t *)flat);
+            else
+                printf("str: %p", object);
+            break;
+        }
+        case OT_BUF: {
+            buf_t *buf = (buf_t *)object;
+            printf("%.*s", buf->length, buf->chars);
+            break;
+        }
+        case OT_SLICE: {
+            slice_t *slice = (slice_t *)object;
+            printf("%.*s", slice->length, slice->chars);
+            break;
+        }
         default:
             printf("obj: %p", object);
             break;
@@ -135,11 +690,12 @@ void obj_print(obj_t *object)
 
 void obj_free(gc_t *gc, obj_t *object)
 {
+    gc->counts[object->type]--;
+
     switch (object->type) {
         case OT_STR: {
             str_t *string = (str_t *)object;
-            free(string->chars);
-            FREE(gc, str_t, string);
+            gc_realloc(gc, string, STR_SIZE(string->length), 0);
             break;
         }
         case OT_FUN: {
@@ -150,10 +706,48 @@ void obj_free(gc_t *gc, obj_t *object)
         }
         case OT_MAP: {
             map_t *map = (map_t *)object;
-            hash_free(&map->hash);
-            tab_free(&map->table);
+            FREE_ARRAY(gc, val_t, map->array, map->arrayCapacity);
+            dict_free(&map->dict);
             FREE(gc, map_t, map);
             break;
         }
+        case OT_ROPE:
+            FREE(gc, rope_t, object);
+            break;
+        case OT_BUF: {
+            buf_t *buf = (buf_t *)object;
+            FREE_ARRAY(gc, char, buf->chars, buf->capacity);
+            FREE(gc, buf_t, buf);
+            break;
+        }
+        case OT_SLICE:
+            FREE(gc, slice_t, object);
+            break;
+        case OT_F64ARRAY: {
+            f64array_t *array = (f64array_t *)object;
+            gc_realloc(gc, array, F64ARRAY_SIZE(array->length), 0);
+            break;
+        }
+        case OT_PMAP:
+            FREE(gc, pmap_t, object);
+            break;
+        case OT_PNODE: {
+            pnode_t *node = (pnode_t *)object;
+            gc_realloc(gc, node, PNODE_SIZE(node->length), 0);
+            break;
+        }
+        case OT_FUTURE: {
+            future_t *future = (future_t *)object;
+            gc_realloc(gc, future, FUTURE_SIZE(future->argCount), 0);
+            break;
+        }
+        case OT_CHANNEL: {
+            channel_t *channel = (channel_t *)object;
+            mutex_destroy(&channel->lock);
+            gc_realloc(gc, channel, CHANNEL_SIZE(channel->capacity), 0);
+            break;
+        }
+        case OT_COUNT:
+            break;
     }
 }
@@ -1,20 +1,27 @@
 #pragma once
 
+#include <stdatomic.h>
+
 #include "value.h"
 #include "chunk.h"
 #include "table.h"
-#include "hash.h"
+#include "dict.h"
 
 struct _obj {
     otype_t type;
+    bool marked;
     struct _obj *next;
 };
 
+// Strings are shared between threads, so the fields filled in lazily
+// are atomic. Whoever computes them first stores the same value.
 struct _str {
     obj_t obj;
-    char *chars;
     int length;
-    uint32_t hash;
+    _Atomic uint32_t hash;  // 0 until the string is hashed.
+    atomic_bool interned;
+    _Atomic uint8_t ascii;  // ASCII_UNKNOWN until the string is scanned.
+    char chars[];
 };
 
 struct _fun {
@@ -24,16 +31,105 @@ struct _fun {
     str_t *name;
 };
 
+// Keys 0..arrayCapacity-1 live in the array part, nil when absent, the
+// other numbers and the strings in dict. A map belongs to one thread, it
+// can't be handed to another one, and a map kept in a global may only be
+// read by the others.
 struct _map {
     obj_t obj;
-    hash_t hash;
-    tab_t table;
+    val_t *array;
+    int arrayCapacity;
+    int arrayCount;     // Slots of the array that are not nil.
+    dict_t dict;
 };
 
+// A string concatenated lazily, flattened on first use as a key,
+// in a comparison or when printed. Another thread may be walking the
+// parts, they are dropped only by the collector.
+struct _rope {
+    obj_t obj;
+    int length;
+    obj_t *left;
+    obj_t *right;
+    _Atomic(str_t *) flat;  // Published once, the first flattening wins.
+};
+
+// A substring sharing the characters of its parent, copied out only
+// when used as a key or where a NUL terminated string is needed.
+struct _slice {
+    obj_t obj;
+    int length;
+    _Atomic uint8_t ascii;
+    const char *chars;
+    str_t *parent;          // Dropped by the collector once flattened.
+    _Atomic(str_t *) flat;
+};
+
+struct _buf {
+    obj_t obj;
+    int length;
+    int capacity;
+    char *chars;
+};
+
+// A fixed number of doubles stored contiguously.
+struct _f64array {
+    obj_t obj;
+    int length;
+    double values[];
+};
+
+// An immutable map, a hash array mapped trie. Setting or removing a key
+// copies the nodes on its path and shares all the others.
+struct _pmap {
+    obj_t obj;
+    int count;
+    pnode_t *root;      // NULL when empty.
+};
+
+// Five bits of the hash per level pick one of 32 slots. Past the last
+// bits a node holds colliding keys in plain pairs.
+struct _pnode {
+    obj_t obj;
+    uint32_t datamap;   // Slots holding a key and its value.
+    uint32_t nodemap;   // Slots holding a child node.
+    int length;
+    val_t slots[];      // Keys and values in pairs, then the children.
+};
+
+// The result of a call queued in the task pool.
+struct _future {
+    obj_t obj;
+    atomic_int state;   // FUTURE_PENDING, FUTURE_RUNNING or FUTURE_DONE.
+    future_t *next;     // In the pool's shared queue.
+    val_t result;
+    int argCount;
+    val_t values[];     // The callee, then its arguments.
+};
+
+#define ROPE_MIN_LENGTH 64
+#define SLICE_MIN_LENGTH 24     // Shorter substrings are cheaper to copy.
+
+#define ASCII_UNKNOWN   0
+#define ASCII_YES       1
+#define ASCII_NO        2
+
+#define STR_SIZE(n)     (sizeof(str_t) + (n) + 1)
+#define F64ARRAY_SIZE(n) (sizeof(f64array_t) + (size_t)(n) * sizeof(double))
+#define PNODE_SIZE(n)   (sizeof(pnode_t) + (size_t)(n) * sizeof(val_t))
+#define FUTURE_SIZE(n)  (sizeof(future_t) + (size_t)((n) + 1) * sizeof(val_t))
+
 #define AS_STR(v)       ((str_t *)AS_OBJ(v))
 #define AS_CSTR(v)      (((str_t *)AS_OBJ(v))->chars)
 #define AS_FUN(v)       ((fun_t *)AS_OBJ(v))
 #define AS_MAP(v)       ((map_t *)AS_OBJ(v))
+#define AS_ROPE(v)      ((rope_t *)AS_OBJ(v))
+#define AS_SLICE(v)     ((slice_t *)AS_OBJ(v))
+#define AS_BUF(v)       ((buf_t *)AS_OBJ(v))
+#define AS_F64ARRAY(v)  ((f64array_t *)AS_OBJ(v))
+#define AS_PMAP(v)      ((pmap_t *)AS_OBJ(v))
+#define AS_FUTURE(v)    ((future_t *)AS_OBJ(v))
+#define AS_CHANNEL(v)   ((channel_t *)AS_OBJ(v))
 
 #define OBJ_TYPE(v)     (AS_OBJ(v)->type)
 
@@ -44,15 +140,90 @@ static inline bool obj_is(val_t value, otype_t type) {
 #define IS_STR(v)       (obj_is(v, OT_STR))
 #define IS_FUN(v)       (obj_is(v, OT_FUN))
 #define IS_MAP(v)       (obj_is(v, OT_MAP))
+#define IS_ROPE(v)      (obj_is(v, OT_ROPE))
+#define IS_SLICE(v)     (obj_is(v, OT_SLICE))
+#define IS_BUF(v)       (obj_is(v, OT_BUF))
+#define IS_F64ARRAY(v)  (obj_is(v, OT_F64ARRAY))
+#define IS_PMAP(v)      (obj_is(v, OT_PMAP))
+#define IS_FUTURE(v)    (obj_is(v, OT_FUTURE))
+#define IS_CHANNEL(v)   (obj_is(v, OT_CHANNEL))
+#define IS_STRING(v)    (IS_STR(v) || IS_ROPE(v) || IS_SLICE(v))
+
+// Maps, string buffers and float arrays change in place without a lock,
+// so they stay with the thread that made them. Everything else is either
+// immutable or locks itself.
+static inline bool obj_shareable(val_t value) {
+    return !IS_MAP(value) && !IS_BUF(value) && !IS_F64ARRAY(value);
+}
+
+static inline int str_length(obj_t *object) {
+    switch (object->type) {
+        case OT_STR: return ((str_t *)object)->length;
+        case OT_ROPE: return ((rope_t *)object)->length;
+        default: return ((slice_t *)object)->length;
+    }
+}
+
+// The characters of a string or a slice, not NUL terminated for slices.
+static inline const char *str_view(obj_t *object) {
+    return object->type == OT_STR ? ((str_t *)object)->chars : ((slice_t *)object)->chars;
+}
 
-str_t *str_take(vm_t *vm, char *chars, int length);
+str_t *str_new(vm_t *vm, int length);
+str_t *str_intern(vm_t *vm, str_t *string);
+str_t *str_key(vm_t *vm, val_t *slot);
 str_t *str_copy(vm_t *vm, const char *chars, int length);
+str_t *str_flatten(vm_t *vm, val_t *slot);
+obj_t *str_slice(vm_t *vm, val_t *slot, int start, int length);
+
+bool str_ascii(obj_t *object);
+int str_runes(obj_t *object);
+int str_offset(obj_t *object, int index);
+int str_index(obj_t *object, int offset);
+
+rope_t *rope_new(vm_t *vm, obj_t *left, obj_t *right);
+str_t *rope_flatten(vm_t *vm, rope_t *rope);
+str_t *slice_flatten(vm_t *vm, slice_t *slice);
+
+// The flattened string, NULL until then. Acquired, so that its
+// characters are there too.
+static inline str_t *rope_flat(rope_t *rope) {
+    return atomic_load_explicit(&rope->flat, memory_order_acquire);
+}
+
+static inline str_t *slice_flat(slice_t *slice) {
+    return atomic_load_explicit(&slice->flat, memory_order_acquire);
+}
+
+buf_t *buf_new(vm_t *vm, int capacity);
+void buf_append(vm_t *vm, buf_t *buf, const char *chars, int length);
 
 fun_t *fun_new(vm_t *vm, src_t *source);
 
-map_t *map_new(vm_t *vm, int arr_cap, int tab_cap);
+f64array_t *f64array_new(vm_t *vm, int length);
+
+// Keys are numbers or interned strings, a nil value removes the key.
+pmap_t *pmap_new(vm_t *vm, int count, pnode_t *root);
+bool pmap_get(pmap_t *map, val_t key, val_t *value);
+pmap_t *pmap_set(vm_t *vm, pmap_t *map, val_t key, val_t value);
+
+// The array slot of a key, if it has one.
+static inline val_t *map_slot(map_t *map, double key) {
+    if (key >= 0 && key < map->arrayCapacity) {
+        int index = (int)key;
+        if (index == key) return &map->array[index];
+    }
+    return NULL;
+}
+
+map_t *map_new(vm_t *vm, int arr_cap, int dict_cap);
+map_t *map_copy(vm_t *vm, map_t *from, int arr_cap);
 void map_set(vm_t *vm, map_t *map, const char *key, val_t value);
+val_t map_geti(map_t *map, double key);
+void map_seti(vm_t *vm, map_t *map, double key, val_t value);
 
+obj_t *obj_alloc(vm_t *vm, size_t size, otype_t type);
 const char *obj_typeof(obj_t *object);
+size_t obj_size(obj_t *object);
 void obj_print(obj_t *object);
 void obj_free(gc_t *gc, obj_t *object);
@@ -6,6 +6,7 @@
 #include "parser.h"
 #include "lexer.h"
 #include "object.h"
+#include "vm.h"
 
 typedef struct _parser   parser_t;
 typedef struct _compiler compiler_t;
@@ -16,6 +17,8 @@ struct _parser {
     lexer_t *lexer;
     src_t *source;
     compiler_t *compiler;
+    arena_t arena;
+    fun_t *script;
     tok_t current;
     tok_t previous;
     int subExprs;
@@ -184,7 +187,7 @@ static void emitReturn(parser_t *parser)
 
 static uint8_t makeConstant(parser_t *parser, val_t value)
 {
-    int constant = arr_add(&currentChunk(parser)->constants, value, false);
+    int constant = chunk_const(currentChunk(parser), value);
     if (constant > UINT8_MAX) {
         error(parser, "Too many constants in one chunk.");
         return 0;
@@ -225,6 +228,9 @@ static void initCompiler(parser_t *parser, compiler_t *compiler, funtype_t type)
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
     compiler->function = fun_new(parser->vm, parser->source);
+    compiler->function->chunk.arena = &parser->arena;
+    // Keep the function reachable while it is being compiled.
+    vm_push(parser->vm, VAL_OBJ(compiler->function));
 
     if (type != TYPE_SCRIPT) {
         compiler->function->name = str_copy(parser->vm, parser->previous.start,
@@ -243,6 +249,8 @@ static fun_t *endCompiler(parser_t *parser)
 {
     emitReturn(parser);
     fun_t *function = parser->compiler->function;
+    chunk_finalize(&function->chunk);
+    vm_pop(parser->vm);
 
 #ifdef DEBUG_PRINT_CODE                      
     if (!parser->hadError) {
@@ -494,19 +502,200 @@ static void string(parser_t *parser, bool canAssign)
     emitConstant(parser, VAL_OBJ(s));
 }
 
+// Whether the element starting at token is a lone literal, scanning on
+// with lexer. It needs a look past the literal as in [1 + 2] the 1
+// starts an expression. Leaves the literal in token.
+static bool literalElement(lexer_t *lexer, tok_t *token, bool *negate)
+{
+    *negate = token->type == TOKEN_MINUS;
+
+    if (*negate) {
+        *token = lexer_scan(lexer);
+        if (token->type != TOKEN_NUMBER) return false;
+    }
+
+    switch (token->type) {
+        case TOKEN_NUMBER:
+        case TOKEN_STRING:
+        case TOKEN_TRUE:
+        case TOKEN_FALSE:
+        case TOKEN_NIL:
+            break;
+        default:
+            return false;
+    }
+
+    tok_t next = lexer_scan(lexer);
+    return next.type == TOKEN_COMMA || next.type == TOKEN_RIGHT_BRACKET;
+}
+
+// An element that is a lone literal, which is consumed.
+static bool constantElement(parser_t *parser, val_t *value)
+{
+    lexer_t lexer = *parser->lexer;
+    tok_t token = parser->current;
+    bool negate;
+
+    if (!literalElement(&lexer, &token, &negate)) return false;
+
+    switch (token.type) {
+        case TOKEN_NUMBER: {
+            double n = strtod(token.start, NULL);
+            *value = VAL_NUM(negate ? -n : n);
+            break;
+        }
+        case TOKEN_STRING:
+            *value = VAL_OBJ(str_copy(parser->vm, token.start + 1, token.length - 2));
+            break;
+        case TOKEN_TRUE:    *value = VAL_TRUE; break;
+        case TOKEN_FALSE:   *value = VAL_FALSE; break;
+        default:            *value = VAL_NIL; break;
+    }
+
+    advance(parser);
+    if (negate) advance(parser);
+    return true;
+}
+
+// Whether a lone literal follows in the rest of the literal, looking
+// from an element that is not one.
+static bool constantAhead(parser_t *parser)
+{
+    lexer_t lexer = *parser->lexer;
+    int depth = 0;
+
+    for (tok_t token = parser->current;; token = lexer_scan(&lexer)) {
+        switch (token.type) {
+            case TOKEN_LEFT_PAREN:
+            case TOKEN_LEFT_BRACKET:
+            case TOKEN_LEFT_BRACE:
+                depth++;
+                break;
+            case TOKEN_RIGHT_PAREN:
+            case TOKEN_RIGHT_BRACE:
+                depth--;
+                break;
+            case TOKEN_RIGHT_BRACKET:
+                if (depth-- == 0) return false;
+                break;
+            case TOKEN_COMMA:
+                if (depth == 0) {
+                    lexer_t element = lexer;
+                    tok_t first = lexer_scan(&element);
+                    bool negate;
+                    if (literalElement(&element, &first, &negate)) return true;
+                }
+                break;
+            case TOKEN_EOF:
+            case TOKEN_ERROR:
+                return false;
+            default:
+                break;
+        }
+    }
+}
+
+// Emits the map to fill, a copy of a template when there are constants,
+// and returns where its size goes.
+static int emitMap(parser_t *parser, map_t *constants, int *template)
+{
+    if (constants == NULL) {
+        emitByte(parser, OP_MAP);
+    }
+    else {
+        *template = makeConstant(parser, VAL_OBJ(constants));
+        emitBytes(parser, OP_MAPK, (uint8_t)*template);
+    }
+
+    emitBytes(parser, 0, 0);
+    return currentChunk(parser)->count - 2;
+}
+
+static void emitFill(parser_t *parser, int start, int count)
+{
+    if (count == 0) return;
+
+    emitByte(parser, OP_FILL);
+    emitBytes(parser, (start >> 8) & 0xff, start & 0xff);
+    emitByte(parser, (uint8_t)count);
+}
+
+// The constants of a literal laid out in an array part of its size.
+static map_t *makeTemplate(parser_t *parser, map_t *constants, int count)
+{
+    map_t *template = map_new(parser->vm, count, 0);
+
+    for (int i = 0; i < count; i++) {
+        template->array[i] = map_geti(constants, i);
+        if (!IS_NIL(template->array[i])) template->arrayCount++;
+    }
+    return template;
+}
+
 static void map(parser_t *parser, bool canAssign)
 {
-    uint8_t count = 0;
+    vm_t *vm = parser->vm;
+    map_t *constants = NULL;
+    int count = 0, pending = 0;
+    int size = -1, template = -1;
 
     if (!check(parser, TOKEN_RIGHT_BRACKET)) {
         do {
-            expression(parser);
-            count++;
+            val_t value;
+
+            // Constants go to the template, unless the map was already
+            // made without one, the rest is evaluated into the map.
+            if ((size < 0 || constants != NULL) && constantElement(parser, &value)) {
+                emitFill(parser, count - pending, pending);
+                pending = 0;
+
+                if (constants == NULL) {
+                    vm_push(vm, value);
+                    constants = map_new(vm, 0, 0);
+                    vm_pop(vm);
+                    vm_push(vm, VAL_OBJ(constants));
+                }
+
+                vm_push(vm, value);
+                map_seti(vm, constants, count, value);
+                vm_pop(vm);
+            }
+            else {
+                if (size < 0) {
+                    // A template is still worth it for the constants after.
+                    if (constants == NULL && constantAhead(parser)) {
+                        constants = map_new(vm, 0, 0);
+                        vm_push(vm, VAL_OBJ(constants));
+                    }
+                    size = emitMap(parser, constants, &template);
+                }
+
+                expression(parser);
+                if (++pending == UINT8_MAX) {
+                    emitFill(parser, count + 1 - pending, pending);
+                    pending = 0;
+                }
+            }
+
+            if (++count > UINT16_MAX) {
+                error(parser, "Too many elements in a map literal.");
+            }
         } while (match(parser, TOKEN_COMMA));
     }
 
     consume(parser, TOKEN_RIGHT_BRACKET, "Expected closing ']'.");
-    emitBytes(parser, OP_MAP, count);
+
+    if (size < 0) size = emitMap(parser, constants, &template);
+    emitFill(parser, count - pending, pending);
+
+    currentChunk(parser)->code[size] = (count >> 8) & 0xff;
+    currentChunk(parser)->code[size + 1] = count & 0xff;
+
+    if (constants != NULL) {
+        currentChunk(parser)->constants.values[template] =
+            VAL_OBJ(makeTemplate(parser, constants, count));
+        vm_pop(vm);
+    }
 }
 
 static void namedVariable(parser_t *parser, tok_t name, bool canAssign)
@@ -848,27 +1037,53 @@ static void statement(parser_t *parser)
     }
 }
 
+static void script(vm_t *vm, void *data)
+{
+    parser_t *parser = data;
+    compiler_t compiler;
+
+    initCompiler(parser, &compiler, TYPE_SCRIPT);
+
+    advance(parser);
+    while (!match(parser, TOKEN_EOF)) {
+        declaration(parser);
+    }
+
+    parser->script = endCompiler(parser);
+}
+
 fun_t *compile(vm_t *vm, src_t *source)
 {
     lexer_t lexer;
     parser_t parser;
-    compiler_t compiler;
+    val_t *top = vm->top;
 
     parser.vm = vm;
     parser.source = source;
     parser.lexer = &lexer;
     parser.compiler = NULL;
+    parser.script = NULL;
     parser.hadError = false;
     parser.panicMode = false;
+    arena_init(&parser.arena);
 
     lexer_init(&lexer, source);
-    initCompiler(&parser, &compiler, TYPE_SCRIPT);
-    
-    advance(&parser);
-    while (!match(&parser, TOKEN_EOF)) {
-        declaration(&parser);
+
+    if (!vm_protect(vm, script, &parser)) {
+        fprintf(stderr, "[%s] Error: Out of memory.\n", source->fname);
+
+        // The functions left unfinished are still on the stack, their
+        // chunks point into the arena about to go.
+        for (val_t *slot = top; slot < vm->top; slot++) {
+            if (IS_FUN(*slot) && AS_FUN(*slot)->chunk.arena == &parser.arena) {
+                chunk_free(&AS_FUN(*slot)->chunk);
+            }
+        }
+
+        vm->top = top;
+        parser.hadError = true;
     }
 
-    fun_t *function = endCompiler(&parser);
-    return parser.hadError ? NULL : function;
+    arena_free(&parser.arena);
+    return parser.hadError ? NULL : parser.script;
 }
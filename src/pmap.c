@@ -0,0 +1,382 @@
+#include <string.h>
+
+#include "object.h"
+#include "hash.h"
+#include "vm.h"
+
+#define BITS        5
+#define HASH_BITS   32
+
+static inline bool isCollision(int shift)
+{
+    return shift >= HASH_BITS;
+}
+
+static inline uint32_t slotBit(uint32_t hash, int shift)
+{
+    return 1u << ((hash >> shift) & ((1u << BITS) - 1));
+}
+
+// Position of a slot among the ones set in a bitmap.
+static inline int slotIndex(uint32_t bitmap, uint32_t bit)
+{
+    return bit_count(bitmap & (bit - 1));
+}
+
+// Keys compare as in a dict, numbers by their normalized bits.
+static inline val_t normalizeKey(val_t key)
+{
+    if (IS_NUM(key)) key.raw = hash_normalize(key.raw);
+    return key;
+}
+
+static inline uint32_t keyHash(val_t key)
+{
+    return IS_NUM(key) ? (uint32_t)hash_mix(key.raw) : AS_STR(key)->hash;
+}
+
+static inline bool keysEqual(val_t a, val_t b)
+{
+    return a.type == b.type && a.raw == b.raw;
+}
+
+static pnode_t *newNode(vm_t *vm, uint32_t datamap, uint32_t nodemap, int length)
+{
+    pnode_t *node = (pnode_t *)obj_alloc(vm, PNODE_SIZE(length), OT_PNODE);
+    node->datamap = datamap;
+    node->nodemap = nodemap;
+    node->length = length;
+    return node;
+}
+
+static pnode_t *copyNode(vm_t *vm, pnode_t *node)
+{
+    vm_push(vm, VAL_OBJ(node));
+    pnode_t *copy = newNode(vm, node->datamap, node->nodemap, node->length);
+    memcpy(copy->slots, node->slots, node->length * sizeof(val_t));
+    vm_pop(vm);
+    return copy;
+}
+
+// A copy with a pair inserted before the value at index.
+static pnode_t *insertPair(vm_t *vm, pnode_t *node, uint32_t datamap, int index,
+    val_t key, val_t value)
+{
+    vm_push(vm, VAL_OBJ(node));
+    pnode_t *copy = newNode(vm, datamap, node->nodemap, node->length + 2);
+    vm_pop(vm);
+
+    memcpy(copy->slots, node->slots, index * sizeof(val_t));
+    copy->slots[index] = key;
+    copy->slots[index + 1] = value;
+    memcpy(copy->slots + index + 2, node->slots + index,
+        (node->length - index) * sizeof(val_t));
+    return copy;
+}
+
+// A copy without the pair at index.
+static pnode_t *removePair(vm_t *vm, pnode_t *node, uint32_t datamap, int index)
+{
+    vm_push(vm, VAL_OBJ(node));
+    pnode_t *copy = newNode(vm, datamap, node->nodemap, node->length - 2);
+    vm_pop(vm);
+
+    memcpy(copy->slots, node->slots, index * sizeof(val_t));
+    memcpy(copy->slots + index, node->slots + index + 2,
+        (node->length - index - 2) * sizeof(val_t));
+    return copy;
+}
+
+// A copy with the pair at from moved down as the child at to, or the
+// reverse, both indexes taken in the node after the move.
+static pnode_t *pairToChild(vm_t *vm, pnode_t *node, uint32_t bit, pnode_t *child)
+{
+    int from = 2 * slotIndex(node->datamap, bit);
+    int to = 2 * (bit_count(node->datamap) - 1) + slotIndex(node->nodemap, bit);
+
+    vm_push(vm, VAL_OBJ(node));
+    vm_push(vm, VAL_OBJ(child));
+    pnode_t *copy = newNode(vm, node->datamap ^ bit, node->nodemap | bit, node->length - 1);
+    vm_pop(vm);
+    vm_pop(vm);
+
+    memcpy(copy->slots, node->slots, from * sizeof(val_t));
+    memcpy(copy->slots + from, node->slots + from + 2, (to - from) * sizeof(val_t));
+    copy->slots[to] = VAL_OBJ(child);
+    memcpy(copy->slots + to + 1, node->slots + to + 2,
+        (node->length - to - 2) * sizeof(val_t));
+    return copy;
+}
+
+static pnode_t *childToPair(vm_t *vm, pnode_t *node, uint32_t bit, val_t key, val_t value)
+{
+    int from = 2 * bit_count(node->datamap) + slotIndex(node->nodemap, bit);
+    int to = 2 * slotIndex(node->datamap, bit);
+
+    vm_push(vm, VAL_OBJ(node));
+    pnode_t *copy = newNode(vm, node->datamap | bit, node->nodemap ^ bit, node->length + 1);
+    vm_pop(vm);
+
+    memcpy(copy->slots, node->slots, to * sizeof(val_t));
+    copy->slots[to] = key;
+    copy->slots[to + 1] = value;
+    memcpy(copy->slots + to + 2, node->slots + to, (from - to) * sizeof(val_t));
+    memcpy(copy->slots + from + 2, node->slots + from + 1,
+        (node->length - from - 1) * sizeof(val_t));
+    return copy;
+}
+
+// The smallest subtree holding two keys that share the bits above shift.
+static pnode_t *mergePairs(vm_t *vm, int shift, val_t key1, val_t value1, uint32_t hash1,
+    val_t key2, val_t value2, uint32_t hash2)
+{
+    if (isCollision(shift)) {
+        pnode_t *node = newNode(vm, 0, 0, 4);
+        node->slots[0] = key1;
+        node->slots[1] = value1;
+        node->slots[2] = key2;
+        node->slots[3] = value2;
+        return node;
+    }
+
+    uint32_t bit1 = slotBit(hash1, shift);
+    uint32_t bit2 = slotBit(hash2, shift);
+
+    if (bit1 == bit2) {
+        pnode_t *child = mergePairs(vm, shift + BITS, key1, value1, hash1, key2, value2, hash2);
+        vm_push(vm, VAL_OBJ(child));
+        pnode_t *node = newNode(vm, 0, bit1, 1);
+        vm_pop(vm);
+
+        node->slots[0] = VAL_OBJ(child);
+        return node;
+    }
+
+    pnode_t *node = newNode(vm, bit1 | bit2, 0, 4);
+    int first = bit1 < bit2 ? 0 : 2;
+    node->slots[first] = key1;
+    node->slots[first + 1] = value1;
+    node->slots[2 - first] = key2;
+    node->slots[3 - first] = value2;
+    return node;
+}
+
+static pnode_t *nodeSet(vm_t *vm, pnode_t *node, int shift, val_t key, uint32_t hash,
+    val_t value, int *delta)
+{
+    if (isCollision(shift)) {
+        for (int i = 0; i < node->length; i += 2) {
+            if (keysEqual(node->slots[i], key)) {
+                pnode_t *copy = copyNode(vm, node);
+                copy->slots[i + 1] = value;
+                return copy;
+            }
+        }
+
+        *delta = 1;
+        return insertPair(vm, node, 0, node->length, key, value);
+    }
+
+    uint32_t bit = slotBit(hash, shift);
+
+    if (node->datamap & bit) {
+        int index = 2 * slotIndex(node->datamap, bit);
+        val_t other = node->slots[index];
+
+        if (keysEqual(other, key)) {
+            pnode_t *copy = copyNode(vm, node);
+            copy->slots[index + 1] = value;
+            return copy;
+        }
+
+        vm_push(vm, VAL_OBJ(node));
+        pnode_t *child = mergePairs(vm, shift + BITS, other, node->slots[index + 1],
+            keyHash(other), key, value, hash);
+        vm_pop(vm);
+
+        *delta = 1;
+        return pairToChild(vm, node, bit, child);
+    }
+
+    if (node->nodemap & bit) {
+        int index = 2 * bit_count(node->datamap) + slotIndex(node->nodemap, bit);
+
+        vm_push(vm, VAL_OBJ(node));
+        pnode_t *child = nodeSet(vm, (pnode_t *)AS_OBJ(node->slots[index]), shift + BITS,
+            key, hash, value, delta);
+        vm_push(vm, VAL_OBJ(child));
+        pnode_t *copy = copyNode(vm, node);
+        vm_pop(vm);
+        vm_pop(vm);
+
+        copy->slots[index] = VAL_OBJ(child);
+        return copy;
+    }
+
+    *delta = 1;
+    return insertPair(vm, node, node->datamap | bit,
+        2 * slotIndex(node->datamap, bit), key, value);
+}
+
+// NULL once the node holds nothing. A child left with a single pair is
+// pulled up into its parent, so every path ends as soon as it can.
+static pnode_t *nodeRemove(vm_t *vm, pnode_t *node, int shift, val_t key, uint32_t hash,
+    int *delta)
+{
+    if (isCollision(shift)) {
+        for (int i = 0; i < node->length; i += 2) {
+            if (keysEqual(node->slots[i], key)) {
+                *delta = -1;
+                return node->length == 2 ? NULL : removePair(vm, node, 0, i);
+            }
+        }
+        return node;
+    }
+
+    uint32_t bit = slotBit(hash, shift);
+
+    if (node->datamap & bit) {
+        int index = 2 * slotIndex(node->datamap, bit);
+        if (!keysEqual(node->slots[index], key)) return node;
+
+        *delta = -1;
+        if (node->length == 2) return NULL;
+        return removePair(vm, node, node->datamap ^ bit, index);
+    }
+
+    if (node->nodemap & bit) {
+        int index = 2 * bit_count(node->datamap) + slotIndex(node->nodemap, bit);
+        pnode_t *child = (pnode_t *)AS_OBJ(node->slots[index]);
+
+        vm_push(vm, VAL_OBJ(node));
+        pnode_t *result = nodeRemove(vm, child, shift + BITS, key, hash, delta);
+        vm_pop(vm);
+
+        if (result == child) return node;
+
+        if (result == NULL) {
+            if (node->length == 1) return NULL;
+
+            vm_push(vm, VAL_OBJ(node));
+            pnode_t *copy = newNode(vm, node->datamap, node->nodemap ^ bit, node->length - 1);
+            vm_pop(vm);
+
+            memcpy(copy->slots, node->slots, index * sizeof(val_t));
+            memcpy(copy->slots + index, node->slots + index + 1,
+                (node->length - index - 1) * sizeof(val_t));
+            return copy;
+        }
+
+        if (result->nodemap == 0 && result->length == 2) {
+            // A lone child pair passes up until a node has something else.
+            if (node->length == 1) return result;
+
+            vm_push(vm, VAL_OBJ(result));
+            pnode_t *copy = childToPair(vm, node, bit, result->slots[0], result->slots[1]);
+            vm_pop(vm);
+            return copy;
+        }
+
+        vm_push(vm, VAL_OBJ(result));
+        pnode_t *copy = copyNode(vm, node);
+        vm_pop(vm);
+
+        copy->slots[index] = VAL_OBJ(result);
+        return copy;
+    }
+
+    return node;
+}
+
+pmap_t *pmap_new(vm_t *vm, int count, pnode_t *root)
+{
+    vm_push(vm, VAL_OBJ(root));
+    pmap_t *map = (pmap_t *)obj_alloc(vm, sizeof(pmap_t), OT_PMAP);
+    vm_pop(vm);
+
+    map->count = count;
+    map->root = root;
+    return map;
+}
+
+bool pmap_get(pmap_t *map, val_t key, val_t *value)
+{
+    if (map->root == NULL) return false;
+
+    key = normalizeKey(key);
+    uint32_t hash = keyHash(key);
+    pnode_t *node = map->root;
+
+    for (int shift = 0;; shift += BITS) {
+        if (isCollision(shift)) {
+            for (int i = 0; i < node->length; i += 2) {
+                if (keysEqual(node->slots[i], key)) {
+                    *value = node->slots[i + 1];
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        uint32_t bit = slotBit(hash, shift);
+
+        if (node->datamap & bit) {
+            int index = 2 * slotIndex(node->datamap, bit);
+            if (!keysEqual(node->slots[index], key)) return false;
+
+            *value = node->slots[index + 1];
+            return true;
+        }
+
+        if (!(node->nodemap & bit)) return false;
+
+        int index = 2 * bit_count(node->datamap) + slotIndex(node->nodemap, bit);
+        node = (pnode_t *)AS_OBJ(node->slots[index]);
+    }
+}
+
+// The map and the key must be reachable, the result shares every node
+// off the path to the key with the map.
+pmap_t *pmap_set(vm_t *vm, pmap_t *map, val_t key, val_t value)
+{
+    key = normalizeKey(key);
+    uint32_t hash = keyHash(key);
+    int delta = 0;
+    pnode_t *root;
+
+    vm_push(vm, value);
+
+    if (IS_NIL(value)) {
+        root = map->root != NULL ? nodeRemove(vm, map->root, 0, key, hash, &delta) : NULL;
+    }
+    else if (map->root == NULL) {
+        root = newNode(vm, slotBit(hash, 0), 0, 2);
+        root->slots[0] = key;
+        root->slots[1] = value;
+        delta = 1;
+    }
+    else {
+        root = nodeSet(vm, map->root, 0, key, hash, value, &delta);
+    }
+
+    if (root != NULL && root->nodemap == 0 && root->length == 2) {
+        // A lone pair passed up from deeper down still has the bit of its
+        // old level.
+        uint32_t bit = slotBit(keyHash(root->slots[0]), 0);
+
+        if (root->datamap != bit) {
+            vm_push(vm, VAL_OBJ(root));
+            pnode_t *pair = newNode(vm, bit, 0, 2);
+            vm_pop(vm);
+
+            pair->slots[0] = root->slots[0];
+            pair->slots[1] = root->slots[1];
+            root = pair;
+        }
+    }
+
+    vm_pop(vm);
+
+    if (root == map->root) return map;
+    return pmap_new(vm, map->count + delta, root);
+}
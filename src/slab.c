@@ -0,0 +1,258 @@
+#ifndef _WIN32
+#define _DEFAULT_SOURCE             // For MAP_ANONYMOUS and madvise.
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "slab.h"
+
+#define PAGE_BODY(p)        ((char *)(p) + ((sizeof(page_t) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1)))
+#define PAGE_END(p)         ((char *)(p) + SLAB_PAGE_SIZE)
+#define PAGE_OF(ptr)        ((page_t *)((uintptr_t)(ptr) & ~(uintptr_t)(SLAB_PAGE_SIZE - 1)))
+
+static size_t osPageSize()
+{
+    static size_t size = 0;
+
+    if (size == 0) {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        size = info.dwPageSize;
+#else
+        size = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+    }
+
+    return size;
+}
+
+static page_t *mapPage()
+{
+#ifdef _WIN32
+    // Allocations are aligned to 64K, the allocation granularity.
+    return VirtualAlloc(NULL, SLAB_PAGE_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    // Over-map and trim so that every page is aligned to its own size,
+    // that lets a block find its page header by masking its address.
+    size_t size = SLAB_PAGE_SIZE * 2;
+    char *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return NULL;
+
+    char *page = (char *)PAGE_OF(mem + SLAB_PAGE_SIZE - 1);
+    char *end = page + SLAB_PAGE_SIZE;
+
+    if (page > mem) munmap(mem, page - mem);
+    if (end < mem + size) munmap(end, mem + size - end);
+
+    return (page_t *)page;
+#endif
+}
+
+static void unmapPage(page_t *page)
+{
+#ifdef _WIN32
+    VirtualFree(page, 0, MEM_RELEASE);
+#else
+    munmap(page, SLAB_PAGE_SIZE);
+#endif
+}
+
+static void discardPage(page_t *page)
+{
+    // Keep the OS page holding the header, so that the pool stays linked.
+    size_t keep = osPageSize();
+    if (keep >= SLAB_PAGE_SIZE) return;
+
+#ifdef _WIN32
+    VirtualAlloc((char *)page + keep, SLAB_PAGE_SIZE - keep, MEM_RESET, PAGE_READWRITE);
+#else
+    madvise((char *)page + keep, SLAB_PAGE_SIZE - keep, MADV_DONTNEED);
+#endif
+}
+
+static void unlinkPage(page_t **list, page_t *page)
+{
+    if (page->prev != NULL) page->prev->next = page->next;
+    else *list = page->next;
+    if (page->next != NULL) page->next->prev = page->prev;
+
+    page->prev = NULL;
+    page->next = NULL;
+}
+
+static void linkPage(page_t **list, page_t *page)
+{
+    page->prev = NULL;
+    page->next = *list;
+    if (*list != NULL) (*list)->prev = page;
+    *list = page;
+}
+
+static bool isFull(page_t *page)
+{
+    size_t size = (page->cls + 1) * SLAB_ALIGN;
+    return page->free == NULL && page->bump + size > PAGE_END(page);
+}
+
+static page_t *newPage(slab_t *slab, int cls)
+{
+    page_t *page = slab->pool;
+
+    if (page != NULL) {
+        slab->pool = page->next;
+        slab->pooled--;
+    }
+    else {
+        page = mapPage();
+        if (page == NULL) return NULL;
+        slab->mapped += SLAB_PAGE_SIZE;
+    }
+
+    page->prev = NULL;
+    page->next = NULL;
+    page->free = NULL;
+    page->bump = PAGE_BODY(page);
+    page->used = 0;
+    page->cls = cls;
+    return page;
+}
+
+static void releasePage(slab_t *slab, page_t *page)
+{
+    if (slab->pooled >= SLAB_POOL_MAX) {
+        unmapPage(page);
+        slab->mapped -= SLAB_PAGE_SIZE;
+        return;
+    }
+
+    discardPage(page);
+    page->next = slab->pool;
+    slab->pool = page;
+    slab->pooled++;
+}
+
+void slab_init(slab_t *slab)
+{
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        slab->classes[i].pages = NULL;
+        slab->classes[i].full = NULL;
+    }
+
+    slab->pool = NULL;
+    slab->pooled = 0;
+    slab->mapped = 0;
+}
+
+static void freePages(page_t *page)
+{
+    while (page != NULL) {
+        page_t *next = page->next;
+        unmapPage(page);
+        page = next;
+    }
+}
+
+void slab_free(slab_t *slab)
+{
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        freePages(slab->classes[i].pages);
+        freePages(slab->classes[i].full);
+    }
+
+    freePages(slab->pool);
+    slab_init(slab);
+}
+
+void *slab_alloc(slab_t *slab, size_t size)
+{
+    if (size > SLAB_MAX_SIZE) return malloc(size);
+
+    int cls = SLAB_CLASS(size);
+    slab_class_t *class = &slab->classes[cls];
+    page_t *page = class->pages;
+
+    if (page == NULL) {
+        page = newPage(slab, cls);
+        if (page == NULL) return NULL;
+        linkPage(&class->pages, page);
+    }
+
+    void *block;
+    if (page->free != NULL) {
+        block = page->free;
+        page->free = *(void **)block;
+    }
+    else {
+        block = page->bump;
+        page->bump += (cls + 1) * SLAB_ALIGN;
+    }
+
+    page->used++;
+    if (isFull(page)) {
+        unlinkPage(&class->pages, page);
+        linkPage(&class->full, page);
+    }
+
+    return block;
+}
+
+void slab_release(slab_t *slab, void *ptr, size_t size)
+{
+    if (ptr == NULL) return;
+
+    if (size > SLAB_MAX_SIZE) {
+        free(ptr);
+        return;
+    }
+
+    page_t *page = PAGE_OF(ptr);
+    slab_class_t *class = &slab->classes[page->cls];
+
+    if (isFull(page)) {
+        unlinkPage(&class->full, page);
+        linkPage(&class->pages, page);
+    }
+
+    *(void **)ptr = page->free;
+    page->free = ptr;
+
+    // Keep the last partial page around, so that a class which keeps
+    // allocating and freeing one block doesn't map and unmap each time.
+    if (--page->used == 0 && (page->prev != NULL || page->next != NULL)) {
+        unlinkPage(&class->pages, page);
+        releasePage(slab, page);
+    }
+}
+
+void *slab_realloc(slab_t *slab, void *ptr, size_t old, size_t new)
+{
+    if (new == 0) {
+        slab_release(slab, ptr, old);
+        return NULL;
+    }
+
+    if (ptr == NULL) return slab_alloc(slab, new);
+
+    if (old > SLAB_MAX_SIZE && new > SLAB_MAX_SIZE) {
+        return realloc(ptr, new);
+    }
+
+    if (SLAB_ROUND(old) == SLAB_ROUND(new)) return ptr;
+
+    void *block = slab_alloc(slab, new);
+    if (block == NULL) return NULL;
+
+    memcpy(block, ptr, old < new ? old : new);
+    slab_release(slab, ptr, old);
+    return block;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "common.h"
+
+#define SLAB_PAGE_SIZE      (64 * 1024)
+#define SLAB_ALIGN          16
+#define SLAB_MAX_SIZE       256
+#define SLAB_CLASSES        (SLAB_MAX_SIZE / SLAB_ALIGN)
+#define SLAB_POOL_MAX       16
+
+#define SLAB_CLASS(size)    (((size) - 1) / SLAB_ALIGN)
+#define SLAB_ROUND(size)    ((size) == 0 ? 0 : (size) > SLAB_MAX_SIZE ? (size) \
+                                : (SLAB_CLASS(size) + 1) * SLAB_ALIGN)
+
+typedef struct _page page_t;
+
+struct _page {
+    page_t *prev;
+    page_t *next;
+    void *free;         // Freed blocks, linked through their first word.
+    char *bump;         // Start of the never used tail of the page.
+    int used;
+    int cls;
+};
+
+typedef struct {
+    page_t *pages;      // Pages with at least one free block.
+    page_t *full;
+} slab_class_t;
+
+typedef struct {
+    slab_class_t classes[SLAB_CLASSES];
+    page_t *pool;       // Empty pages, their bodies given back to the OS.
+    int pooled;
+    size_t mapped;
+} slab_t;
+
+void slab_init(slab_t *slab);
+void slab_free(slab_t *slab);
+
+void *slab_alloc(slab_t *slab, size_t size);
+void slab_release(slab_t *slab, void *ptr, size_t size);
+void *slab_realloc(slab_t *slab, void *ptr, size_t old, size_t new);
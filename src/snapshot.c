@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <ctype.h>
+
+#include "gc.h"
+#include "vm.h"
+#include "object.h"
+#include "channel.h"
+
+// Heap snapshot, one record per line:
+//
+//   lox-heap 1
+//   n <id> <type> <size> [label]    an object and its own memory
+//   e <from> <to> [label]           a reference, <from> can be 'root'
+//
+// Ids are object addresses, labels never contain spaces.
+
+static void writeLabel(FILE *file, const char *chars, int length)
+{
+    fputc(' ', file);
+    for (int i = 0; i < length && i < 32; i++) {
+        unsigned char c = chars[i];
+        fputc(isgraph(c) ? c : '_', file);
+    }
+}
+
+static void writeEdge(FILE *file, void *from, val_t to, str_t *label)
+{
+    if (!IS_OBJ(to) || AS_OBJ(to) == NULL) return;
+
+    if (from == NULL)
+        fprintf(file, "e root %p", (void *)AS_OBJ(to));
+    else
+        fprintf(file, "e %p %p", from, (void *)AS_OBJ(to));
+
+    if (label != NULL) writeLabel(file, label->chars, label->length);
+    fputc('\n', file);
+}
+
+static void writeTable(FILE *file, void *from, tab_t *table)
+{
+    for (int i = 0; i < table->capacity; i++) {
+        str_t *key = tab_key(table, i);
+        if (key == NULL) continue;
+
+        writeEdge(file, from, VAL_OBJ(key), NULL);
+        writeEdge(file, from, tab_value(table, i), key);
+    }
+}
+
+static void writeDict(FILE *file, void *from, dict_t *dict)
+{
+    for (int i = 0; i < dict->used; i++) {
+        entry_t *entry = &dict->entries[i];
+        if (entry->keyType == VT_NIL) continue;
+
+        val_t key = dict_key(entry);
+        writeEdge(file, from, key, NULL);
+        writeEdge(file, from, dict_value(entry), IS_OBJ(key) ? AS_STR(key) : NULL);
+    }
+}
+
+static void writeObject(FILE *file, obj_t *object)
+{
+    fprintf(file, "n %p %s %zu", (void *)object,
+        obj_typeof(object), obj_size(object));
+
+    switch (object->type) {
+        case OT_STR: {
+            str_t *string = (str_t *)object;
+            writeLabel(file, string->chars, string->length);
+            fputc('\n', file);
+            break;
+        }
+        case OT_FUN: {
+            fun_t *function = (fun_t *)object;
+            arr_t *constants = &function->chunk.constants;
+
+            if (function->name != NULL)
+                writeLabel(file, function->name->chars, function->name->length);
+            fputc('\n', file);
+
+            writeEdge(file, object, VAL_OBJ(function->name), NULL);
+            for (int i = 0; i < constants->count; i++) {
+                writeEdge(file, object, constants->values[i], NULL);
+            }
+            break;
+        }
+        case OT_MAP: {
+            map_t *map = (map_t *)object;
+            fputc('\n', file);
+
+            for (int i = 0; i < map->arrayCapacity; i++) {
+                writeEdge(file, object, map->array[i], NULL);
+            }
+            writeDict(file, object, &map->dict);
+            break;
+        }
+        case OT_ROPE: {
+            rope_t *rope = (rope_t *)object;
+            fputc('\n', file);
+
+            writeEdge(file, object, VAL_OBJ(rope->left), NULL);
+            writeEdge(file, object, VAL_OBJ(rope->right), NULL);
+            writeEdge(file, object, VAL_OBJ(rope->flat), NULL);
+            break;
+        }
+        case OT_SLICE: {
+            slice_t *slice = (slice_t *)object;
+            writeLabel(file, slice->chars, slice->length);
+            fputc('\n', file);
+
+            writeEdge(file, object, VAL_OBJ(slice->parent), NULL);
+            writeEdge(file, object, VAL_OBJ(slice->flat), NULL);
+            break;
+        }
+        case OT_PMAP: {
+            pmap_t *map = (pmap_t *)object;
+            fputc('\n', file);
+
+            writeEdge(file, object, VAL_OBJ(map->root), NULL);
+            break;
+        }
+        case OT_PNODE: {
+            pnode_t *node = (pnode_t *)object;
+            fputc('\n', file);
+
+            for (int i = 0; i < node->length; i++) {
+                writeEdge(file, object, node->slots[i], NULL);
+            }
+            break;
+        }
+        case OT_FUTURE: {
+            future_t *future = (future_t *)object;
+            fputc('\n', file);
+
+            writeEdge(file, object, future->result, NULL);
+            if (atomic_load(&future->state) != FUTURE_DONE) {
+                for (int i = 0; i <= future->argCount; i++) {
+                    writeEdge(file, object, future->values[i], NULL);
+                }
+            }
+            break;
+        }
+        case OT_CHANNEL: {
+            channel_t *channel = (channel_t *)object;
+            size_t sent = atomic_load(&channel->sent);
+            fputc('\n', file);
+
+            for (size_t i = atomic_load(&channel->received); i < sent; i++) {
+                cell_t *cell = &channel->cells[i & (channel->capacity - 1)];
+                if (atomic_load(&cell->sequence) == i + 1) writeEdge(file, object, cell->value, NULL);
+            }
+            break;
+        }
+        default:
+            fputc('\n', file);
+            break;
+    }
+}
+
+bool gc_snapshot(gc_t *gc, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL) return false;
+
+    fprintf(file, "lox-heap 1\n");
+    gc_stop(gc);
+
+    for (obj_t *object = gc->objects; object != NULL; object = object->next) {
+        writeObject(file, object);
+    }
+
+    for (vm_t *vm = gc->vms; vm != NULL; vm = vm->next) {
+        for (val_t *slot = vm->stack; slot < vm->top; slot++) {
+            writeEdge(file, NULL, *slot, NULL);
+        }
+
+        for (int i = 0; i < vm->frameCount; i++) {
+            writeEdge(file, NULL, VAL_OBJ(vm->frames[i].function), NULL);
+        }
+    }
+
+    if (gc->vms != NULL) {
+        writeTable(file, NULL, gc->vms->globals);
+    }
+
+    gc_resume(gc);
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
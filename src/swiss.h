@@ -0,0 +1,92 @@
+#pragma once
+
+#include "common.h"
+
+#ifdef HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+// Open addressing in groups of 16 slots. Each slot has a control byte,
+// either empty, deleted or the low 7 bits of its key's hash, so a whole
+// group is checked against a key with one compare.
+
+#define SWISS_GROUP         16
+#define SWISS_EMPTY         ((uint8_t)0x80)
+#define SWISS_DELETED       ((uint8_t)0xFE)
+
+#define SWISS_H1(hash)      ((uint32_t)(hash) >> 7)
+#define SWISS_H2(hash)      ((uint8_t)((hash) & 0x7F))
+#define SWISS_IS_FULL(c)    (((c) & 0x80) == 0)
+
+// A group has a free slot past this load, so probing always stops.
+#define SWISS_MAX_LOAD(cap) ((cap) - (cap) / 8)
+
+static inline uint32_t swiss_match(const uint8_t *group, uint8_t h2)
+{
+#ifdef HAS_SSE2
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)h2)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < SWISS_GROUP; i++) {
+        if (group[i] == h2) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+static inline uint32_t swiss_empty(const uint8_t *group)
+{
+    return swiss_match(group, SWISS_EMPTY);
+}
+
+// Empty or deleted slots, the only ones with the high bit set.
+static inline uint32_t swiss_free(const uint8_t *group)
+{
+#ifdef HAS_SSE2
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < SWISS_GROUP; i++) {
+        if (!SWISS_IS_FULL(group[i])) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+// A group held in two words, the byte of slot i at bits 8 * i, for tables
+// that load their control bytes atomically.
+static inline void swiss_unpack(uint64_t low, uint64_t high, uint8_t *group)
+{
+    for (int i = 0; i < SWISS_GROUP / 2; i++) {
+        group[i] = (uint8_t)(low >> i * 8);
+        group[i + SWISS_GROUP / 2] = (uint8_t)(high >> i * 8);
+    }
+}
+
+static inline uint32_t swiss_match_words(uint64_t low, uint64_t high, uint8_t h2)
+{
+#ifdef HAS_SSE2
+    __m128i ctrl = _mm_set_epi64x((long long)high, (long long)low);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)h2)));
+#else
+    uint8_t group[SWISS_GROUP];
+    swiss_unpack(low, high, group);
+    return swiss_match(group, h2);
+#endif
+}
+
+static inline uint32_t swiss_free_words(uint64_t low, uint64_t high)
+{
+#ifdef HAS_SSE2
+    return (uint32_t)_mm_movemask_epi8(_mm_set_epi64x((long long)high, (long long)low));
+#else
+    uint8_t group[SWISS_GROUP];
+    swiss_unpack(low, high, group);
+    return swiss_free(group);
+#endif
+}
+
+// Groups are visited in triangular steps, which reach every group when
+// their count is a power of two.
+#define SWISS_NEXT(group, step, mask)   ((group) = ((group) + ++(step)) & (mask))
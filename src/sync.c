@@ -0,0 +1,17 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L     // For nanosleep.
+#endif
+
+#include <time.h>
+
+#include "sync.h"
+
+void os_sleep(int ms)
+{
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec time = { ms / 1000, (long)(ms % 1000) * 1000000 };
+    nanosleep(&time, NULL);
+#endif
+}
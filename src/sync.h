@@ -0,0 +1,104 @@
+#pragma once
+
+#include "common.h"
+
+// Locks, conditions and OS threads, the little of them the runtime uses,
+// over Win32 or pthreads.
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef SRWLOCK mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+typedef HANDLE os_thread_t;
+
+#define OS_THREAD_ROUTINE(name) DWORD WINAPI name(void *data)
+
+static inline void mutex_init(mutex_t *mutex) { InitializeSRWLock(mutex); }
+static inline void mutex_destroy(mutex_t *mutex) { (void)mutex; }
+static inline void mutex_lock(mutex_t *mutex) { AcquireSRWLockExclusive(mutex); }
+static inline void mutex_unlock(mutex_t *mutex) { ReleaseSRWLockExclusive(mutex); }
+
+static inline void cond_init(cond_t *cond) { InitializeConditionVariable(cond); }
+static inline void cond_destroy(cond_t *cond) { (void)cond; }
+static inline void cond_signal(cond_t *cond) { WakeConditionVariable(cond); }
+static inline void cond_broadcast(cond_t *cond) { WakeAllConditionVariable(cond); }
+
+static inline void cond_wait(cond_t *cond, mutex_t *mutex) {
+    SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+}
+
+static inline void cond_timedwait(cond_t *cond, mutex_t *mutex, int ms) {
+    SleepConditionVariableSRW(cond, mutex, (DWORD)ms, 0);
+}
+
+static inline bool os_thread_create(os_thread_t *thread,
+    LPTHREAD_START_ROUTINE routine, void *data) {
+    *thread = CreateThread(NULL, 0, routine, data, 0, NULL);
+    return *thread != NULL;
+}
+
+static inline void os_thread_join(os_thread_t thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+static inline int cpu_count() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+}
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+typedef pthread_t os_thread_t;
+
+#define OS_THREAD_ROUTINE(name) void *name(void *data)
+
+static inline void mutex_init(mutex_t *mutex) { pthread_mutex_init(mutex, NULL); }
+static inline void mutex_destroy(mutex_t *mutex) { pthread_mutex_destroy(mutex); }
+static inline void mutex_lock(mutex_t *mutex) { pthread_mutex_lock(mutex); }
+static inline void mutex_unlock(mutex_t *mutex) { pthread_mutex_unlock(mutex); }
+
+static inline void cond_init(cond_t *cond) { pthread_cond_init(cond, NULL); }
+static inline void cond_destroy(cond_t *cond) { pthread_cond_destroy(cond); }
+static inline void cond_signal(cond_t *cond) { pthread_cond_signal(cond); }
+static inline void cond_broadcast(cond_t *cond) { pthread_cond_broadcast(cond); }
+
+static inline void cond_wait(cond_t *cond, mutex_t *mutex) {
+    pthread_cond_wait(cond, mutex);
+}
+
+static inline void cond_timedwait(cond_t *cond, mutex_t *mutex, int ms) {
+    struct timespec until;
+    timespec_get(&until, TIME_UTC);
+    until.tv_sec += ms / 1000;
+    until.tv_nsec += (long)(ms % 1000) * 1000000;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(cond, mutex, &until);
+}
+
+static inline bool os_thread_create(os_thread_t *thread,
+    void *(*routine)(void *), void *data) {
+    return pthread_create(thread, NULL, routine, data) == 0;
+}
+
+static inline void os_thread_join(os_thread_t thread) {
+    pthread_join(thread, NULL);
+}
+
+static inline int cpu_count() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+#endif
+
+// Out of line, it needs more of POSIX than C11 declares.
+void os_sleep(int ms);
@@ -1,147 +1,365 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "table.h"
 #include "object.h"
+#include "swiss.h"
+#include "gc.h"
 
-#define TABLE_MAX_LOAD  0.75
+#define TABLE_MIN       8
 
-void tab_init(tab_t *table)
+// A table smaller than a group uses its first slots, the other control
+// bytes stay empty and are never handed out.
+#define GROUP_MASK(cap) ((cap) < SWISS_GROUP ? 0 : (uint32_t)(cap) / SWISS_GROUP - 1)
+#define SLOT_MASK(cap)  ((cap) < SWISS_GROUP ? (1u << (cap)) - 1 : 0xFFFFu)
+
+// Readers race with the writer, so every shared field is atomic but
+// ordered only by the version.
+#define LOAD(x)         atomic_load_explicit(&(x), memory_order_relaxed)
+#define STORE(x, v)     atomic_store_explicit(&(x), (v), memory_order_relaxed)
+
+static void resetArrays(tab_t *table)
+{
+    STORE(table->count, 0);
+    table->deleted = 0;
+    STORE(table->capacity, 0);
+    STORE(table->ctrl, NULL);
+    STORE(table->keys, NULL);
+    STORE(table->values, NULL);
+}
+
+void tab_init(tab_t *table, gc_t *gc)
 {
-    table->count = 0;
-    table->capacity = 0;
-    table->entries = NULL;
+    resetArrays(table);
+    table->gc = gc;
+
+    mutex_init(&table->lock);
+    atomic_init(&table->version, 0);
+    table->retired = NULL;
 }
 
 void tab_free(tab_t *table)
 {
-    free(table->entries);
-    tab_init(table);
+    gc_realloc(table->gc, LOAD(table->values), TAB_SIZE(LOAD(table->capacity)), 0);
+    tab_reclaim(table);
+    resetArrays(table);
+    mutex_destroy(&table->lock);
 }
 
-static ent_t *findEntry(ent_t *entries, int capacity, str_t *key)
+static void beginWrite(tab_t *table)
 {
-    uint32_t index = key->hash % capacity;
-    ent_t *tombstone = NULL;
+    mutex_lock(&table->lock);
+    gc_hold(table->gc);
 
-    for (;;) {
-        ent_t *entry = &entries[index];
+    unsigned version = atomic_load_explicit(&table->version, memory_order_relaxed);
+    atomic_store_explicit(&table->version, version + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
 
-        if (entry->key == NULL) {
-            if (IS_NIL(entry->value)) {
-                // Empty entry.                              
-                return tombstone != NULL ? tombstone : entry;
-            }
-            else {
-                // We found a tombstone.                     
-                if (tombstone == NULL) tombstone = entry;
-            }
-        }
-        else if (entry->key == key) {
-            // We found the key.                           
-            return entry;
+static void endWrite(tab_t *table)
+{
+    atomic_fetch_add_explicit(&table->version, 1, memory_order_release);
+    gc_release(table->gc);
+    mutex_unlock(&table->lock);
+}
+
+// Control bytes come eight to a word and two words to a group.
+static inline uint32_t matchGroup(ctrl_t *ctrl, uint32_t group, uint8_t byte)
+{
+    return swiss_match_words(LOAD(ctrl[group * 2]), LOAD(ctrl[group * 2 + 1]), byte);
+}
+
+static inline uint32_t freeGroup(ctrl_t *ctrl, uint32_t group)
+{
+    return swiss_free_words(LOAD(ctrl[group * 2]), LOAD(ctrl[group * 2 + 1]));
+}
+
+// Only writers change a byte, holding the lock.
+static inline void setCtrl(ctrl_t *ctrl, int slot, uint8_t byte)
+{
+    int shift = slot % 8 * 8;
+    uint64_t word = LOAD(ctrl[slot / 8]) & ~(0xFFull << shift);
+    STORE(ctrl[slot / 8], word | (uint64_t)byte << shift);
+}
+
+static inline uint8_t getCtrl(ctrl_t *ctrl, int slot)
+{
+    return (uint8_t)(LOAD(ctrl[slot / 8]) >> (slot % 8 * 8));
+}
+
+static inline void setValue(tval_t *values, int slot, val_t value)
+{
+    STORE(values[slot].type, (uint32_t)value.type);
+    STORE(values[slot].raw, value.raw);
+}
+
+static inline val_t getValue(tval_t *values, int slot)
+{
+    return (val_t){ .type = (vtype_t)LOAD(values[slot].type), .raw = LOAD(values[slot].raw) };
+}
+
+// The caller copies the value whole, so it is stored in one piece as
+// two halves would hold up that load until they are written.
+static inline void putValue(val_t *to, val_t value)
+{
+#ifdef HAS_SSE2
+    _mm_storeu_si128((__m128i *)to, _mm_set_epi64x((long long)value.raw, (long long)value.type));
+#else
+    *to = value;
+#endif
+}
+
+// Visits each group at most once, a reader may look at control bytes
+// that a writer is changing.
+static inline int findKey(ctrl_t *ctrl, _Atomic(str_t *) *keys, int capacity, str_t *key)
+{
+    uint32_t hash = LOAD(key->hash);
+    uint32_t mask = GROUP_MASK(capacity);
+    uint32_t group = SWISS_H1(hash) & mask;
+    uint8_t h2 = SWISS_H2(hash);
+
+    for (uint32_t step = 0; step <= mask; SWISS_NEXT(group, step, mask)) {
+        for (uint32_t match = matchGroup(ctrl, group, h2); match != 0; match &= match - 1) {
+            int slot = group * SWISS_GROUP + bit_first(match);
+            if (LOAD(keys[slot]) == key) return slot;
         }
 
-        index = (index + 1) % capacity;
+        if (matchGroup(ctrl, group, SWISS_EMPTY) != 0) return -1;
     }
+
+    return -1;
+}
+
+static int findSlot(ctrl_t *ctrl, int capacity, uint32_t hash)
+{
+    uint32_t mask = GROUP_MASK(capacity);
+    uint32_t group = SWISS_H1(hash) & mask;
+
+    for (uint32_t step = 0;; SWISS_NEXT(group, step, mask)) {
+        uint32_t free = freeGroup(ctrl, group) & SLOT_MASK(capacity);
+        if (free != 0) return group * SWISS_GROUP + bit_first(free);
+    }
+}
+
+// One attempt, false when a writer got in the way.
+static inline bool tryGet(tab_t *table, str_t *key, val_t *value, bool *found)
+{
+    unsigned version = atomic_load_explicit(&table->version, memory_order_acquire);
+    if (version & 1) return false;
+
+    int count = LOAD(table->count);
+    int capacity = LOAD(table->capacity);
+    ctrl_t *ctrl = LOAD(table->ctrl);
+    _Atomic(str_t *) *keys = LOAD(table->keys);
+    tval_t *values = LOAD(table->values);
+
+    // Arrays from one version, probed only when they belong together.
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&table->version, memory_order_relaxed) != version) return false;
+
+    int slot = count == 0 ? -1 : findKey(ctrl, keys, capacity, key);
+    val_t result = slot >= 0 ? getValue(values, slot) : VAL_NIL;
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&table->version, memory_order_relaxed) != version) return false;
+
+    if (slot >= 0) putValue(value, result);
+    *found = slot >= 0;
+    return true;
+}
+
+static bool retryGet(tab_t *table, str_t *key, val_t *value)
+{
+    bool found;
+    while (!tryGet(table, key, value, &found)) {}
+    return found;
 }
 
+// The retries stay out of line, keeping global loads as lean as before.
 bool tab_get(tab_t *table, str_t *key, val_t *value)
 {
-    if (table->count == 0) return false;
+    bool found;
+    if (tryGet(table, key, value, &found)) return found;
+    return retryGet(table, key, value);
+}
+
+// A replaced block waits for tab_reclaim, linked through its first value
+// which a reader may still be loading.
+static void retire(tab_t *table, tval_t *values, int capacity)
+{
+    if (values == NULL) return;
 
-    ent_t *entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    STORE(values[0].raw, (uint64_t)(uintptr_t)table->retired);
+    STORE(values[0].type, (uint32_t)capacity);
+    table->retired = values;
+}
+
+// The new arrays are filled before a reader can find them.
+static bool adjustCapacity(tab_t *table, int capacity)
+{
+    tval_t *values = ALLOC(table->gc, TAB_SIZE(capacity));
+    if (values == NULL) return false;
 
-    *value = entry->value;
+    _Atomic(str_t *) *keys = (_Atomic(str_t *) *)(values + capacity);
+    ctrl_t *ctrl = (ctrl_t *)(keys + capacity);
+    int words = (capacity < SWISS_GROUP ? SWISS_GROUP : capacity) / 8;
+
+    for (int i = 0; i < capacity; i++) atomic_init(&keys[i], NULL);
+    for (int i = 0; i < words; i++) atomic_init(&ctrl[i], SWISS_EMPTY * 0x0101010101010101ull);
+
+    int oldCapacity = LOAD(table->capacity);
+    _Atomic(str_t *) *oldKeys = LOAD(table->keys);
+    tval_t *oldValues = LOAD(table->values);
+
+    for (int i = 0; i < oldCapacity; i++) {
+        str_t *key = LOAD(oldKeys[i]);
+        if (key == NULL) continue;
+
+        int slot = findSlot(ctrl, capacity, key->hash);
+        setCtrl(ctrl, slot, SWISS_H2(key->hash));
+        STORE(keys[slot], key);
+        setValue(values, slot, getValue(oldValues, i));
+    }
+
+    retire(table, oldValues, oldCapacity);
+    STORE(table->values, values);
+    STORE(table->keys, keys);
+    STORE(table->ctrl, ctrl);
+    STORE(table->capacity, capacity);
+    table->deleted = 0;
     return true;
 }
 
-static void adjustCapacity(tab_t *table, int capacity)
+static int lookup(tab_t *table, str_t *key)
 {
-    ent_t *entries = malloc(capacity * sizeof(ent_t));
+    if (LOAD(table->count) == 0) return -1;
+    return findKey(LOAD(table->ctrl), LOAD(table->keys), LOAD(table->capacity), key);
+}
 
-    for (int i = 0; i < capacity; i++) {
-        entries[i].key = NULL;
-        entries[i].value = VAL_NIL;
+static bool insert(tab_t *table, str_t *key, val_t value)
+{
+    int slot = lookup(table, key);
+    if (slot >= 0) {
+        setValue(LOAD(table->values), slot, value);
+        return false;
     }
 
-    table->count = 0;
-    for (int i = 0; i < table->capacity; i++) {
-        ent_t *entry = &table->entries[i];
-        if (entry->key == NULL) continue;
+    int count = LOAD(table->count);
+    if (count + table->deleted + 1 > SWISS_MAX_LOAD(LOAD(table->capacity))) {
+        // Mostly tombstones, so clean them out rather than growing.
+        int capacity = LOAD(table->capacity);
+        if (capacity == 0) capacity = TABLE_MIN;
+        else if (count + 1 > capacity / 2) capacity *= 2;
 
-        ent_t *dest = findEntry(entries, capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
-        table->count++;
+        if (!adjustCapacity(table, capacity)) return false;
     }
 
-    free(table->entries);
-    table->entries = entries;
-    table->capacity = capacity;
+    ctrl_t *ctrl = LOAD(table->ctrl);
+    slot = findSlot(ctrl, LOAD(table->capacity), key->hash);
+    if (getCtrl(ctrl, slot) == SWISS_DELETED) table->deleted--;
+
+    setCtrl(ctrl, slot, SWISS_H2(key->hash));
+    STORE(LOAD(table->keys)[slot], key);
+    setValue(LOAD(table->values), slot, value);
+    STORE(table->count, count + 1);
+    return true;
 }
 
 bool tab_set(tab_t *table, str_t *key, val_t value)
 {
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-        int capacity = GROW_CAPACITY(table->capacity);
-        adjustCapacity(table, capacity);
-    }
+    beginWrite(table);
+    bool added = insert(table, key, value);
+    endWrite(table);
+    return added;
+}
 
-    ent_t *entry = findEntry(table->entries, table->capacity, key);
+// Sets a key only if it is there already.
+bool tab_assign(tab_t *table, str_t *key, val_t value)
+{
+    beginWrite(table);
 
-    bool isNewKey = entry->key == NULL;
-    if (isNewKey && IS_NIL(entry->value)) table->count++;
+    int slot = lookup(table, key);
+    if (slot >= 0) setValue(LOAD(table->values), slot, value);
 
-    entry->key = key;
-    entry->value = value;
-    return isNewKey;
+    endWrite(table);
+    return slot >= 0;
 }
 
 bool tab_remove(tab_t *table, str_t *key)
 {
-    if (table->count == 0) return false;
+    beginWrite(table);
+
+    int slot = lookup(table, key);
+    if (slot < 0) {
+        endWrite(table);
+        return false;
+    }
+
+    // No probe went past a group that still has an empty slot, so the
+    // slot can be emptied rather than left as a tombstone.
+    ctrl_t *ctrl = LOAD(table->ctrl);
+    if (matchGroup(ctrl, slot / SWISS_GROUP, SWISS_EMPTY) != 0) {
+        setCtrl(ctrl, slot, SWISS_EMPTY);
+    }
+    else {
+        setCtrl(ctrl, slot, SWISS_DELETED);
+        table->deleted++;
+    }
+
+    STORE(LOAD(table->keys)[slot], NULL);
+    setValue(LOAD(table->values), slot, VAL_NIL);
+    STORE(table->count, LOAD(table->count) - 1);
 
-    // Find the entry.                                             
-    ent_t *entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    int count = LOAD(table->count);
+    int capacity = LOAD(table->capacity);
+    while (capacity > TABLE_MIN && count < capacity * TABLE_MIN_LOAD) {
+        capacity /= 2;
+    }
 
-    // Place a tombstone in the entry.                             
-    entry->key = NULL;
-    entry->value = VAL_TRUE;
+    // Failing to shrink only leaves the table as it was, and so does
+    // skipping it at the heap limit.
+    if ((capacity < LOAD(table->capacity) || table->deleted > LOAD(table->capacity) / 4)
+        && gc_fits(table->gc, TAB_SIZE(capacity))) {
+        adjustCapacity(table, capacity);
+    }
 
+    endWrite(table);
     return true;
 }
 
-void tab_add(tab_t *from, tab_t *to)
+bool tab_reserve(tab_t *table, int count)
 {
-    for (int i = 0; i < from->capacity; i++) {
-        ent_t *entry = &from->entries[i];
-        if (entry->key != NULL) {
-            tab_set(to, entry->key, entry->value);
-        }
-    }
+    int capacity = TABLE_MIN;
+    while (count > SWISS_MAX_LOAD(capacity)) capacity *= 2;
+
+    beginWrite(table);
+    bool reserved = capacity <= LOAD(table->capacity) || adjustCapacity(table, capacity);
+    endWrite(table);
+    return reserved;
 }
 
-str_t *tab_findstr(tab_t *table, const char *chars, int length, uint32_t hash)
+void tab_add(tab_t *from, tab_t *to)
 {
-    if (table->count == 0) return NULL;
+    beginWrite(to);
 
-    uint32_t index = hash % table->capacity;
+    for (int i = 0; i < LOAD(from->capacity); i++) {
+        str_t *key = tab_key(from, i);
+        if (key != NULL) insert(to, key, tab_value(from, i));
+    }
 
-    for (;;) {
-        ent_t *entry = &table->entries[index];
-        str_t *key = entry->key;
+    endWrite(to);
+}
 
-        if (key == NULL) {
-            // Stop if we find an empty non-tombstone entry.                 
-            if (IS_NIL(entry->value)) return NULL;
-        }
-        else if (key->length == length && key->hash == hash) {
-            // We found it.                                                  
-            return key;
-        }
+// Only while no thread is in tab_get, such as with the world stopped.
+void tab_reclaim(tab_t *table)
+{
+    tval_t *block = table->retired;
 
-        index = (index + 1) % table->capacity;
+    while (block != NULL) {
+        tval_t *next = (tval_t *)(uintptr_t)LOAD(block[0].raw);
+        gc_realloc(table->gc, block, TAB_SIZE(LOAD(block[0].type)), 0);
+        block = next;
     }
+
+    table->retired = NULL;
 }
@@ -1,23 +1,72 @@
 #pragma once
 
+#include <stdatomic.h>
+
 #include "common.h" 
 #include "value.h" 
+#include "sync.h"
+#include "swiss.h"
+
+#define TABLE_MIN_LOAD  0.25
+
+// Control bytes, keys and values in separate arrays of one block, so
+// probing touches only the control bytes and the keys that match.
+//
+// Threads share the table. Writers take the lock and make the version
+// odd while they change it, readers take no lock and try again when the
+// version moved under them. Arrays a writer replaced stay readable until
+// tab_reclaim, called when no thread can be reading.
+//
+// Whatever a reader looks at is atomic, loaded and stored relaxed as the
+// version orders it: the fields, the keys, control bytes eight to a word
+// and values split in their type and their bits.
+typedef _Atomic uint64_t ctrl_t;
 
 typedef struct {
-    str_t *key;
-    val_t value;
-} ent_t;
+    _Atomic uint32_t type;
+    _Atomic uint64_t raw;
+} tval_t;
 
 typedef struct {
-    int count;
-    int capacity;
-    ent_t *entries;
+    _Atomic int count;
+    int deleted;
+    _Atomic int capacity;
+    _Atomic(ctrl_t *) ctrl;
+    _Atomic(_Atomic(str_t *) *) keys;   // NULL in every slot that holds no key.
+    _Atomic(tval_t *) values;
+    gc_t *gc;
+
+    mutex_t lock;
+    atomic_uint version;
+    void *retired;
 } tab_t;
 
-void tab_init(tab_t *table);
+// Small tables still get a whole group of control bytes.
+#define TAB_SIZE(cap)   ((cap) == 0 ? 0 : (size_t)(cap) * (sizeof(tval_t) + sizeof(str_t *)) \
+                            + ((cap) < SWISS_GROUP ? SWISS_GROUP : (cap)))
+
+void tab_init(tab_t *table, gc_t *gc);
 void tab_free(tab_t *table);
 bool tab_get(tab_t *table, str_t *key, val_t *value);
 bool tab_set(tab_t *table, str_t *key, val_t value);
+bool tab_assign(tab_t *table, str_t *key, val_t value);
 bool tab_remove(tab_t *table, str_t *key);
+bool tab_reserve(tab_t *table, int count);
 void tab_add(tab_t *from, tab_t *to);
-str_t *tab_findstr(tab_t *table, const char *chars, int length, uint32_t hash);
+void tab_reclaim(tab_t *table);
+
+// Slot i, for walking the table while no thread writes to it.
+static inline str_t *tab_key(tab_t *table, int i)
+{
+    return atomic_load_explicit(&atomic_load_explicit(&table->keys, memory_order_relaxed)[i],
+        memory_order_relaxed);
+}
+
+static inline val_t tab_value(tab_t *table, int i)
+{
+    tval_t *value = &atomic_load_explicit(&table->values, memory_order_relaxed)[i];
+    return (val_t){
+        .type = (vtype_t)atomic_load_explicit(&value->type, memory_order_relaxed),
+        .raw = atomic_load_explicit(&value->raw, memory_order_relaxed)
+    };
+}
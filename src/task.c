@@ -0,0 +1,347 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "task.h"
+#include "vm.h"
+#include "object.h"
+
+// More workers than this only contend for the queues.
+#define POOL_MAX        64
+
+#define DEQUE_MASK      (DEQUE_SIZE - 1)
+
+// The worker running on this thread, if any.
+static THREAD_LOCAL worker_t *current;
+
+// Picks whom to steal from, different on each thread.
+static THREAD_LOCAL uint32_t seed;
+
+future_t *future_new(vm_t *vm, val_t *values, int argCount)
+{
+    future_t *future = (future_t *)obj_alloc(vm, FUTURE_SIZE(argCount), OT_FUTURE);
+    atomic_init(&future->state, FUTURE_PENDING);
+    future->next = NULL;
+    future->result = VAL_NIL;
+    future->argCount = argCount;
+    memcpy(future->values, values, (size_t)(argCount + 1) * sizeof(val_t));
+    return future;
+}
+
+static bool dequePush(deque_t *deque, future_t *future)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (bottom - top >= DEQUE_SIZE) return false;
+
+    atomic_store_explicit(&deque->items[bottom & DEQUE_MASK], future, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return true;
+}
+
+static future_t *dequeTake(deque_t *deque)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    future_t *future = atomic_load_explicit(&deque->items[bottom & DEQUE_MASK],
+        memory_order_relaxed);
+
+    if (top == bottom) {
+        // The last task, a thief may be taking it as well.
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                memory_order_seq_cst, memory_order_relaxed)) {
+            future = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return future;
+}
+
+static future_t *dequeSteal(deque_t *deque)
+{
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom) return NULL;
+
+    future_t *future = atomic_load_explicit(&deque->items[top & DEQUE_MASK],
+        memory_order_relaxed);
+
+    // Losing the race to another thief or the owner is only a miss.
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+            memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+
+    return future;
+}
+
+static future_t *popShared(pool_t *pool)
+{
+    mutex_lock(&pool->lock);
+
+    future_t *future = pool->head;
+    if (future != NULL) {
+        pool->head = future->next;
+        if (pool->head == NULL) pool->tail = NULL;
+        future->next = NULL;
+    }
+
+    mutex_unlock(&pool->lock);
+    return future;
+}
+
+static future_t *steal(pool_t *pool, worker_t *self)
+{
+    if (pool->count == 0) return NULL;
+
+    // Xorshift, so that thieves spread over their victims.
+    if (seed == 0) seed = (uint32_t)(uintptr_t)&seed | 1;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    int start = (int)(seed % (uint32_t)pool->count);
+
+    for (int i = 0; i < pool->count; i++) {
+        worker_t *victim = &pool->workers[(start + i) % pool->count];
+        if (victim == self) continue;
+
+        future_t *future = dequeSteal(&victim->deque);
+        if (future != NULL) return future;
+    }
+
+    return NULL;
+}
+
+static future_t *findWork(pool_t *pool, worker_t *self)
+{
+    if (atomic_load(&pool->queued) == 0) return NULL;
+
+    future_t *future = NULL;
+    if (self != NULL) future = dequeTake(&self->deque);
+    if (future == NULL) future = popShared(pool);
+    if (future == NULL && atomic_load(&pool->started)) future = steal(pool, self);
+
+    if (future != NULL) atomic_fetch_sub(&pool->queued, 1);
+    return future;
+}
+
+// Whoever takes a task from pending runs it, the others leave it be.
+static bool claim(future_t *future)
+{
+    int pending = FUTURE_PENDING;
+    return atomic_compare_exchange_strong(&future->state, &pending, FUTURE_RUNNING);
+}
+
+// Runs a claimed task on the stack of vm, above whatever is there.
+static void runFuture(pool_t *pool, vm_t *vm, future_t *future)
+{
+    vm_push(vm, VAL_OBJ(future));
+    for (int i = 0; i <= future->argCount; i++) {
+        vm_push(vm, future->values[i]);
+    }
+
+    // Whoever awaits the future gets the result, so it has to be shareable.
+    val_t result = VAL_NIL;
+    if (vm_invoke(vm, future->argCount) == VM_OK) result = vm_pop(vm);
+    if (!obj_shareable(result)) result = VAL_NIL;
+    vm_pop(vm);
+
+    future->result = result;
+    atomic_store(&future->state, FUTURE_DONE);
+
+    if (atomic_load(&pool->waiting) > 0) {
+        mutex_lock(&pool->lock);
+        cond_broadcast(&pool->done);
+        mutex_unlock(&pool->lock);
+    }
+}
+
+static OS_THREAD_ROUTINE(workerRoutine)
+{
+    worker_t *worker = data;
+    pool_t *pool = worker->pool;
+    gc_t *gc = worker->vm->gc;
+    current = worker;
+
+    gc_enter(gc, worker->vm);
+
+    while (!atomic_load(&pool->stopping)) {
+        future_t *future = findWork(pool, worker);
+
+        if (future != NULL) {
+            if (claim(future)) runFuture(pool, worker->vm, future);
+            continue;
+        }
+
+        // An idle worker is out of the heap, collections go on without it.
+        gc_leave(gc);
+        mutex_lock(&pool->lock);
+        atomic_fetch_add(&pool->idle, 1);
+
+        while (!atomic_load(&pool->stopping) && atomic_load(&pool->queued) == 0) {
+            cond_wait(&pool->wake, &pool->lock);
+        }
+
+        atomic_fetch_sub(&pool->idle, 1);
+        mutex_unlock(&pool->lock);
+        gc_enter(gc, worker->vm);
+    }
+
+    gc_leave(gc);
+    return 0;
+}
+
+static void startWorkers(pool_t *pool)
+{
+    mutex_lock(&pool->lock);
+
+    if (!atomic_load(&pool->started)) {
+        int count = cpu_count();
+        if (count > POOL_MAX) count = POOL_MAX;
+
+        pool->workers = malloc(count * sizeof(worker_t));
+        if (pool->workers == NULL) count = 0;
+
+        // The workers only start after they all exist, as thieves look
+        // through the whole array.
+        for (int i = 0; i < count; i++) {
+            worker_t *worker = &pool->workers[i];
+            worker->vm = vm_clone(pool->main);
+            worker->pool = pool;
+            atomic_init(&worker->deque.top, 0);
+            atomic_init(&worker->deque.bottom, 0);
+
+            if (worker->vm == NULL) {
+                count = i;
+                break;
+            }
+        }
+
+        int started = 0;
+        for (int i = 0; i < count; i++) {
+            worker_t *worker = &pool->workers[i];
+            if (!os_thread_create(&worker->thread, workerRoutine, worker)) break;
+            started++;
+        }
+
+        // With no worker at all, tasks still run while they are awaited.
+        for (int i = started; i < count; i++) {
+            vm_close(pool->workers[i].vm);
+        }
+
+        pool->count = started;
+        atomic_store(&pool->started, true);
+    }
+
+    mutex_unlock(&pool->lock);
+}
+
+pool_t *pool_new(vm_t *vm)
+{
+    pool_t *pool = malloc(sizeof(pool_t));
+    if (pool == NULL) return NULL;
+
+    pool->main = vm;
+    pool->workers = NULL;
+    pool->count = 0;
+
+    mutex_init(&pool->lock);
+    cond_init(&pool->wake);
+    cond_init(&pool->done);
+    pool->head = NULL;
+    pool->tail = NULL;
+
+    atomic_init(&pool->started, false);
+    atomic_init(&pool->stopping, false);
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->idle, 0);
+    atomic_init(&pool->waiting, 0);
+    return pool;
+}
+
+// Tasks still queued are dropped, running ones halt at their next call.
+void pool_free(pool_t *pool)
+{
+    if (pool == NULL) return;
+
+    mutex_lock(&pool->lock);
+    atomic_store(&pool->stopping, true);
+    cond_broadcast(&pool->wake);
+    mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->count; i++) {
+        atomic_store(&pool->workers[i].vm->halt, true);
+    }
+
+    for (int i = 0; i < pool->count; i++) {
+        os_thread_join(pool->workers[i].thread);
+        vm_close(pool->workers[i].vm);
+    }
+
+    free(pool->workers);
+    mutex_destroy(&pool->lock);
+    cond_destroy(&pool->wake);
+    cond_destroy(&pool->done);
+    free(pool);
+}
+
+void pool_spawn(pool_t *pool, future_t *future)
+{
+    if (!atomic_load(&pool->started)) startWorkers(pool);
+
+    // Counted first, so that no one taking it sees the count go negative.
+    atomic_fetch_add(&pool->queued, 1);
+
+    if (current == NULL || current->pool != pool || !dequePush(&current->deque, future)) {
+        mutex_lock(&pool->lock);
+        if (pool->tail != NULL) pool->tail->next = future;
+        else pool->head = future;
+        pool->tail = future;
+        mutex_unlock(&pool->lock);
+    }
+
+    if (atomic_load(&pool->idle) > 0) {
+        mutex_lock(&pool->lock);
+        cond_signal(&pool->wake);
+        mutex_unlock(&pool->lock);
+    }
+}
+
+// A task nobody took yet runs right here, nested no deeper than a plain
+// call, otherwise this waits for whoever took it. Running other tasks
+// meanwhile could nest them without bound.
+val_t pool_await(vm_t *vm, future_t *future)
+{
+    pool_t *pool = vm->pool;
+
+    if (claim(future)) {
+        runFuture(pool, vm, future);
+        return future->result;
+    }
+
+    // Out of the heap while waiting, the future is safe in the arguments.
+    gc_leave(vm->gc);
+    mutex_lock(&pool->lock);
+    atomic_fetch_add(&pool->waiting, 1);
+
+    while (atomic_load(&future->state) != FUTURE_DONE) {
+        cond_wait(&pool->done, &pool->lock);
+    }
+
+    atomic_fetch_sub(&pool->waiting, 1);
+    mutex_unlock(&pool->lock);
+    gc_enter(vm->gc, vm);
+
+    return future->result;
+}
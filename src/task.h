@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdatomic.h>
+
+#include "common.h"
+#include "value.h"
+#include "sync.h"
+
+// A fixed set of worker threads, each with a VM cloned from the main one,
+// running queued calls. A worker queues the tasks it spawns on its own
+// deque and runs them newest first, idle workers steal the oldest from
+// the others. Tasks spawned outside the pool go through a shared queue.
+// Awaiting a task that nobody has taken yet runs it in place.
+
+#define FUTURE_PENDING  0
+#define FUTURE_RUNNING  1
+#define FUTURE_DONE     2
+
+#define DEQUE_SIZE      1024    // A power of two, the shared queue takes the rest.
+
+typedef struct _pool pool_t;
+
+// The deque of Chase and Lev, the owner pushes and takes at the bottom
+// while thieves take from the top.
+typedef struct {
+    _Atomic int64_t top;
+    _Atomic int64_t bottom;
+    _Atomic(future_t *) items[DEQUE_SIZE];
+} deque_t;
+
+typedef struct {
+    os_thread_t thread;
+    vm_t *vm;
+    pool_t *pool;
+    deque_t deque;
+} worker_t;
+
+struct _pool {
+    vm_t *main;
+    worker_t *workers;  // Started with the first task.
+    int count;
+
+    mutex_t lock;
+    cond_t wake;        // Idle workers wait here for tasks.
+    cond_t done;        // Awaiting threads wait here for results.
+    future_t *head;     // The shared queue, oldest first.
+    future_t *tail;
+
+    atomic_bool started;
+    atomic_bool stopping;
+    atomic_int queued;  // Tasks in any queue.
+    atomic_int idle;
+    atomic_int waiting;
+};
+
+pool_t *pool_new(vm_t *vm);
+void pool_free(pool_t *pool);
+
+// The callee and the arguments must be reachable.
+future_t *future_new(vm_t *vm, val_t *values, int argCount);
+
+void pool_spawn(pool_t *pool, future_t *future);
+val_t pool_await(vm_t *vm, future_t *future);
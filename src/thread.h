@@ -0,0 +1,36 @@
+#pragma once
+
+#include "common.h"
+#include "value.h"
+#include "sync.h"
+
+// Threads a script started with the thread library. The VM that made
+// them owns them until they are closed, a script ending first halts
+// and joins whatever is left.
+
+typedef struct _thread thread_t;
+
+struct _thread {
+    vm_t *vm;
+    vm_t *main;
+    val_t routine;
+    int argCount;
+    os_thread_t handle;
+    bool started;
+    bool running;       // Started and nobody joining it yet.
+    int status;
+    val_t result;       // Kept on the stack of the thread's VM.
+    thread_t *next;     // In the registry until closed.
+};
+
+typedef struct {
+    mutex_t lock;       // Guards the list and the running flags.
+    thread_t *head;
+} threads_t;
+
+threads_t *threads_new();
+
+// Halts every thread so that none waits on another for good, then
+// joins and closes them.
+void threads_halt(threads_t *threads);
+void threads_free(threads_t *threads);
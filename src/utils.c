@@ -1,21 +1,179 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#pragma intrinsic(_umul128)
+#endif
 
 #include "common.h"
 
-// fnv1a_32
+// wyhash, reads 8 bytes at a time and mixes with 64x64->128 multiplies.
+static const uint64_t secret[4] = {
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+    0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+};
+
+static uint64_t hashSeed = 0;
+static bool seeded = false;
+
+static inline void multiply(uint64_t *a, uint64_t *b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    *a = _umul128(*a, *b, b);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t mix(uint64_t a, uint64_t b)
+{
+    multiply(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t read8(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t read4(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t read3(const uint8_t *p, size_t k)
+{
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+uint64_t hash_wide(const void *bytes, size_t size, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t *)bytes;
+    uint64_t a, b;
+
+    seed ^= mix(seed ^ secret[0], secret[1]);
+
+    if (size <= 16) {
+        if (size >= 4) {
+            size_t k = (size >> 3) << 2;
+            a = (read4(p) << 32) | read4(p + k);
+            b = (read4(p + size - 4) << 32) | read4(p + size - 4 - k);
+        }
+        else if (size > 0) {
+            a = read3(p, size);
+            b = 0;
+        }
+        else {
+            a = b = 0;
+        }
+    }
+    else {
+        size_t i = size;
+
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+                see1 = mix(read8(p + 16) ^ secret[2], read8(p + 24) ^ see1);
+                see2 = mix(read8(p + 32) ^ secret[3], read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+
+        while (i > 16) {
+            seed = mix(read8(p) ^ secret[1], read8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    multiply(&a, &b);
+    return mix(a ^ secret[0] ^ size, b ^ secret[1]);
+}
+
 uint32_t hash_bytes(const void *bytes, size_t size)
 {
-    uint32_t hash = 2166136261u;
-    const uint8_t *bs = (uint8_t *)bytes;
+    uint64_t hash = hash_wide(bytes, size, hashSeed);
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+bool bytes_ascii(const char *chars, size_t size)
+{
+    size_t i = 0;
+
+    // Eight bytes at a time, testing their high bits together.
+    for (; i + 8 <= size; i += 8) {
+        if (read8((const uint8_t *)chars + i) & 0x8080808080808080ull) return false;
+    }
+
+    for (; i < size; i++) {
+        if ((uint8_t)chars[i] & 0x80) return false;
+    }
+
+    return true;
+}
+
+static uint64_t randomSeed()
+{
+    uint64_t seed = 0;
+
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    seed = (uint64_t)counter.QuadPart ^ ((uint64_t)GetCurrentProcessId() << 32);
+#else
+    FILE *file = fopen("/dev/urandom", "rb");
+    if (file != NULL) {
+        if (fread(&seed, sizeof(seed), 1, file) != 1) seed = 0;
+        fclose(file);
+    }
+#endif
 
-    for (size_t i = 0; i < size; i++) {
-        hash ^= bs[i];
-        hash *= 16777619;
+    // Fall back on the clock and the address space layout.
+    seed ^= (uint64_t)time(NULL);
+    seed = mix(seed ^ (uint64_t)clock(), (uint64_t)(uintptr_t)&seed);
+    return mix(seed ^ secret[2], (uint64_t)(uintptr_t)randomSeed ^ secret[3]);
+}
+
+void hash_seed(uint64_t seed)
+{
+    // Every table hashed with the old seed would be lost, so the random
+    // seed is picked only once per process.
+    if (seed == 0) {
+        if (seeded) return;
+        seed = randomSeed();
     }
 
-    return hash;
+    hashSeed = seed;
+    seeded = true;
 }
 
 char *read_file(const char *path, size_t *size)
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "value.h"
 #include "object.h"
@@ -47,6 +48,24 @@ void val_print(val_t value)
     }
 }
 
+static bool objEqual(obj_t *a, obj_t *b)
+{
+    if (a->type != OT_STR && a->type != OT_SLICE) return false;
+    if (b->type != OT_STR && b->type != OT_SLICE) return false;
+
+    if (a->type == OT_STR && b->type == OT_STR) {
+        str_t *sa = (str_t *)a;
+        str_t *sb = (str_t *)b;
+
+        // Two interned strings are equal only when they are the same one.
+        if (sa->interned && sb->interned) return false;
+        if (sa->hash != 0 && sb->hash != 0 && sa->hash != sb->hash) return false;
+    }
+
+    int length = str_length(a);
+    return length == str_length(b) && memcmp(str_view(a), str_view(b), length) == 0;
+}
+
 bool val_equal(val_t a, val_t b)
 {
     vtype_t ta = AS_TYPE(a);
@@ -60,7 +79,7 @@ bool val_equal(val_t a, val_t b)
         case VT_NUM_NUM:
             return AS_NUM(a) == AS_NUM(b);
         case VT_OBJ_OBJ:
-            return AS_OBJ(a) == AS_OBJ(b);
+            return AS_OBJ(a) == AS_OBJ(b) || objEqual(AS_OBJ(a), AS_OBJ(b));
         case VT_CFN_CFN:
             return AS_CFN(a) == AS_CFN(b);
         case VT_PTR_PTR:
@@ -6,6 +6,14 @@ typedef struct _obj obj_t;
 typedef struct _str str_t;
 typedef struct _fun fun_t;
 typedef struct _map map_t;
+typedef struct _rope rope_t;
+typedef struct _slice slice_t;
+typedef struct _buf buf_t;
+typedef struct _f64array f64array_t;
+typedef struct _pmap pmap_t;
+typedef struct _pnode pnode_t;
+typedef struct _future future_t;
+typedef struct _channel channel_t;
 
 typedef enum {
     VT_NIL,
@@ -21,7 +29,16 @@ typedef enum {
 typedef enum {
     OT_STR,
     OT_FUN,
-    OT_MAP
+    OT_MAP,
+    OT_ROPE,
+    OT_BUF,
+    OT_SLICE,
+    OT_F64ARRAY,
+    OT_PMAP,
+    OT_PNODE,
+    OT_FUTURE,
+    OT_CHANNEL,
+    OT_COUNT
 } otype_t;
 
 enum {
@@ -9,10 +9,16 @@
 #include "parser.h"
 #include "object.h"
 
+// The VM executing on this thread, if any.
+static THREAD_LOCAL vm_t *running;
+
+// Unwinds the frames of the innermost vm_invoke, or all of them.
 static void resetStack(vm_t *vm)
 {
-    vm->top = vm->stack;
-    vm->frameCount = 0;
+    if (vm->frameCount > vm->base) {
+        vm->top = vm->frames[vm->base].slots;
+        vm->frameCount = vm->base;
+    }
 }
 
 static void runtimeError(vm_t *vm, const char *format, ...)
@@ -52,15 +58,21 @@ vm_t *vm_create()
     if (vm == NULL) return NULL;
 
     memset(vm, '\0', sizeof(vm_t));
+    hash_seed(0);
+
     vm->gc = malloc(sizeof(gc_t));
     vm->globals = malloc(sizeof(tab_t));
-    vm->strings = malloc(sizeof(tab_t));
+    vm->strings = malloc(sizeof(intern_t));
 
     gc_init(vm->gc);
-    tab_init(vm->globals);
-    tab_init(vm->strings);
+    tab_init(vm->globals, vm->gc);
+    intern_init(vm->strings, vm->gc);
 
-    resetStack(vm);
+    vm->top = vm->stack;
+    gc_attach(vm->gc, vm);
+
+    // The creating thread runs the new VM, clones wait for a thread.
+    gc_enter(vm->gc, vm);
     return vm;
 }
 
@@ -68,8 +80,22 @@ void vm_close(vm_t *vm)
 {
     if (vm == NULL) return;
 
+    gc_detach(vm->gc, vm);
+
+    // A clone shares everything but its stack with its parent.
+    if (vm->parent != NULL) {
+        free(vm);
+        return;
+    }
+
+    // Threads and workers run on clones, which have to go first. All are
+    // halted before any is waited for, one may be joining another.
+    threads_halt(vm->threads);
+    pool_free(vm->pool);
+    threads_free(vm->threads);
+
     tab_free(vm->globals);
-    tab_free(vm->strings);
+    intern_free(vm->strings);
     gc_free(vm->gc);
 
     free(vm->globals);
@@ -89,8 +115,12 @@ vm_t *vm_clone(vm_t *from)
     vm->gc = from->gc;
     vm->globals = from->globals;
     vm->strings = from->strings;
+    vm->pool = from->pool;
+    vm->threads = from->threads;
+    vm->parent = from;
 
-    resetStack(vm);
+    vm->top = vm->stack;
+    gc_attach(vm->gc, vm);
     return vm;
 }
 
@@ -99,6 +129,9 @@ vm_t *vm_clone(vm_t *from)
 #define POPN(n)     *((vm)->top -= (n))
 #define PEEK(i)     ((vm)->top[-1 - (i)])
 
+// Strings index tables by their interned instance.
+#define NEEDS_KEY(v)    (IS_ROPE(v) || IS_SLICE(v) || (IS_STR(v) && !AS_STR(v)->interned))
+
 static void defineNative(vm_t *vm, const char *name, cfn_t function)
 {
     val_t native = VAL_CFN(function);
@@ -116,19 +149,46 @@ static val_t clockNative(vm_t *vm, int argc, val_t *args)
 
 static void concatenate(vm_t *vm)
 {
-    str_t *b = AS_STR(POP());
-    str_t *a = AS_STR(POP());
+    // Keep both operands on the stack, the allocation may collect.
+    int length = str_length(AS_OBJ(PEEK(1))) + str_length(AS_OBJ(PEEK(0)));
+
+    // Long results become ropes, so that appending in a loop is O(1).
+    if (length >= ROPE_MIN_LENGTH) {
+        rope_t *rope = rope_new(vm, AS_OBJ(PEEK(1)), AS_OBJ(PEEK(0)));
+        POPN(2);
+        PUSH(VAL_OBJ(rope));
+        return;
+    }
+
+    // Ropes are never shorter than that, so both are strings or slices.
+    obj_t *b = AS_OBJ(PEEK(0));
+    obj_t *a = AS_OBJ(PEEK(1));
 
-    int length = a->length + b->length;
-    char *chars = malloc((length + 1) * sizeof(char));
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
+    str_t *result = str_new(vm, length);
+    memcpy(result->chars, str_view(a), str_length(a));
+    memcpy(result->chars + str_length(a), str_view(b), str_length(b));
 
-    str_t *result = str_take(vm, chars, length);
+    // Left unhashed and uninterned until it is used as a key.
+    POPN(2);
     PUSH(VAL_OBJ(result));
 }
 
+static val_t charAt(vm_t *vm, obj_t *string, int index)
+{
+    if (index < 0) index += str_runes(string);
+    if (index < 0) return VAL_NIL;
+
+    const char *chars = str_view(string);
+    int length = str_length(string);
+    int start = str_offset(string, index);
+    if (start >= length) return VAL_NIL;
+
+    int end = start + 1;
+    while (end < length && (chars[end] & 0xC0) == 0x80) end++;
+
+    return VAL_OBJ(str_copy(vm, chars + start, end - start));
+}
+
 static bool prepareCall(vm_t *vm, fun_t *function, int argCount)
 {
     if (argCount != function->arity) {
@@ -174,7 +234,7 @@ bool vm_call(vm_t *vm, val_t callee, int argCount)
     return false;
 }
 
-int vm_execute(vm_t *vm)
+static int execute(vm_t *vm)
 {
     register uint8_t *ip;
     register val_t *stack;
@@ -243,6 +303,10 @@ int vm_execute(vm_t *vm)
             int count = READ_BYTE();
 
             for (int i = count-1; i >= 0; i--) {
+                if (IS_ROPE(PEEK(i))) {
+                    STORE_FRAME();
+                    str_flatten(vm, &PEEK(i));
+                }
                 val_print(PEEK(i));
                 if (i > 0) printf("\t");
             }
@@ -285,6 +349,16 @@ int vm_execute(vm_t *vm)
                 return VM_RUNTIME_ERROR;
             }
 
+            // Any script that runs for long keeps calling, so this is
+            // where a halt is seen, also right after a native asked.
+            if (atomic_load_explicit(&vm->halt, memory_order_relaxed)) {
+                resetStack(vm);
+                return VM_HALTED;
+            }
+
+            // Collections on other threads wait for this one here.
+            gc_safepoint(vm->gc);
+
             LOAD_FRAME();
             NEXT;
         }
@@ -292,36 +366,40 @@ int vm_execute(vm_t *vm)
         CODE(RET) {
             val_t result = POP();
 
-            if (--vm->frameCount == 0) {
-                POP();
-                return VM_OK;
-            }
-
             vm->top = frame->slots;
             PUSH(result);
 
+            // The outermost call leaves its result on the stack too.
+            if (--vm->frameCount == vm->base) return VM_OK;
+
             LOAD_FRAME();
             NEXT;
         }
 
         CODE(NOT) {
-            PUSH(VAL_BOOL(IS_FALSEY(POP())));
+            PEEK(0) = VAL_BOOL(IS_FALSEY(PEEK(0)));
             NEXT;
         }
 
         CODE(NEG) {
             switch (AS_TYPE(PEEK(0))) {
                 case VT_BOOL:
-                    PUSH(VAL_NUM(-(char)AS_BOOL(POP())));
+                    PEEK(0) = VAL_NUM(-(char)AS_BOOL(PEEK(0)));
                     NEXT;
                 case VT_NUM:
-                    PUSH(VAL_NUM(-AS_NUM(POP())));
+                    PEEK(0) = VAL_NUM(-AS_NUM(PEEK(0)));
                     NEXT;
             }
             ERROR("Operands must be a number/boolean.");
         }
 
         CODE(EQ) {
+            if (IS_ROPE(PEEK(0)) || IS_ROPE(PEEK(1))) {
+                STORE_FRAME();
+                if (IS_ROPE(PEEK(0))) str_flatten(vm, &PEEK(0));
+                if (IS_ROPE(PEEK(1))) str_flatten(vm, &PEEK(1));
+            }
+
             val_t b = POP();
             val_t a = POP();
             PUSH(VAL_BOOL(val_equal(a, b)));
@@ -389,6 +467,7 @@ int vm_execute(vm_t *vm)
         }
 
         CODE(ADD) {
+            STORE_FRAME();
             switch (CMB_BYTES(AS_TYPE(PEEK(1)), AS_TYPE(PEEK(0)))) {
                 case VT_NUM_NUM: {
                     double b = AS_NUM(POP());
@@ -415,7 +494,7 @@ int vm_execute(vm_t *vm)
                     NEXT;
                 }
                 case VT_OBJ_OBJ:
-                    if (IS_STR(PEEK(0)) && IS_STR(PEEK(1))) {
+                    if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1))) {
                         concatenate(vm);
                         NEXT;
                     }
@@ -514,6 +593,7 @@ int vm_execute(vm_t *vm)
         }
 
         CODE(DEF) {
+            STORE_FRAME();
             str_t *name = READ_STR();
             tab_set(vm->globals, name, PEEK(0));
             POP();
@@ -531,9 +611,9 @@ int vm_execute(vm_t *vm)
         }
 
         CODE(GST) {
+            STORE_FRAME();
             str_t *name = READ_STR();
-            if (tab_set(vm->globals, name, PEEK(0))) {
-                tab_remove(vm->globals, name);
+            if (!tab_assign(vm->globals, name, PEEK(0))) {
                 ERROR("Undefined variable '%s'.", name->chars);
             }
             NEXT;
@@ -562,15 +642,33 @@ int vm_execute(vm_t *vm)
         }
 
         CODE(MAP) {
+            STORE_FRAME();
+            uint16_t size = READ_SHORT();
+            PUSH(VAL_OBJ(map_new(vm, size, 0)));
+            NEXT;
+        }
+
+        CODE(MAPK) {
+            STORE_FRAME();
+            map_t *template = AS_MAP(READ_CONST());
+            uint16_t size = READ_SHORT();
+            PUSH(VAL_OBJ(map_copy(vm, template, size)));
+            NEXT;
+        }
+
+        CODE(FILL) {
+            uint16_t start = READ_SHORT();
             uint8_t count = READ_BYTE();
-            map_t *map = map_new(vm, 0, 0);
+            map_t *map = AS_MAP(PEEK(count));
 
-            for (val_t i = VAL_NUM(count - 1); AS_NUM(i) >= 0; AS_NUM(i) -= 1) {
-                hash_set(&map->hash, AS_RAW(i), PEEK((int)AS_NUM(i)));
+            // The elements were pushed in order, the first is the deepest.
+            for (int i = 0; i < count; i++) {
+                val_t value = PEEK(count - 1 - i);
+                map->array[start + i] = value;
+                if (!IS_NIL(value)) map->arrayCount++;
             }
 
             POPN(count);
-            PUSH(VAL_OBJ(map));
             NEXT;
         }
 
@@ -579,7 +677,13 @@ int vm_execute(vm_t *vm)
                 map_t *map = AS_MAP(PEEK(0));
                 str_t *name = READ_STR();
                 val_t value = VAL_NIL;
-                tab_get(&map->table, name, &value);
+                dict_get(&map->dict, VAL_OBJ(name), &value);
+                POP();
+                PUSH(value);
+            }
+            else if (IS_PMAP(PEEK(0))) {
+                val_t value = VAL_NIL;
+                pmap_get(AS_PMAP(PEEK(0)), VAL_OBJ(READ_STR()), &value);
                 POP();
                 PUSH(value);
             }
@@ -590,15 +694,23 @@ int vm_execute(vm_t *vm)
         }
 
         CODE(SET) {
+            STORE_FRAME();
             if (IS_MAP(PEEK(1))) {
                 map_t *map = AS_MAP(PEEK(1));
                 str_t *name = READ_STR();
                 val_t value = PEEK(0);
-                tab_set(&map->table, name, value);
+
+                if (IS_NIL(value))
+                    dict_remove(&map->dict, VAL_OBJ(name));
+                else
+                    dict_set(&map->dict, VAL_OBJ(name), value);
                 POP();
                 POP();
                 PUSH(value);
             }
+            else if (IS_PMAP(PEEK(1))) {
+                ERROR("Persistent maps are immutable, use pmap.set.");
+            }
             else {
                 ERROR("Operands must be a map.");
             }
@@ -606,12 +718,16 @@ int vm_execute(vm_t *vm)
         }
 
         CODE(GETI) {
+            if (NEEDS_KEY(PEEK(0))) {
+                STORE_FRAME();
+                str_key(vm, &PEEK(0));
+            }
+
             if (IS_MAP(PEEK(1))) {
                 if (IS_NUM(PEEK(0))) {
                     map_t *map = AS_MAP(PEEK(1));
-                    uint64_t key = AS_RAW(PEEK(0));
-                    val_t value = VAL_NIL;
-                    hash_get(&map->hash, key, &value);
+                    val_t *slot = map_slot(map, AS_NUM(PEEK(0)));
+                    val_t value = slot != NULL ? *slot : map_geti(map, AS_NUM(PEEK(0)));
 
                     POP();
                     POP();
@@ -619,9 +735,8 @@ int vm_execute(vm_t *vm)
                 }
                 else if (IS_STR(PEEK(0))) {
                     map_t *map = AS_MAP(PEEK(1));
-                    str_t *key = AS_STR(PEEK(0));
                     val_t value = VAL_NIL;
-                    tab_get(&map->table, key, &value);
+                    dict_get(&map->dict, PEEK(0), &value);
 
                     POP();
                     POP();
@@ -631,6 +746,33 @@ int vm_execute(vm_t *vm)
                     ERROR("Operands must be a number or string.");
                 }
             }
+            else if (IS_PMAP(PEEK(1)) && (IS_NUM(PEEK(0)) || IS_STR(PEEK(0)))) {
+                val_t value = VAL_NIL;
+                pmap_get(AS_PMAP(PEEK(1)), PEEK(0), &value);
+
+                POPN(2);
+                PUSH(value);
+            }
+            else if (IS_F64ARRAY(PEEK(1)) && IS_NUM(PEEK(0))) {
+                f64array_t *array = AS_F64ARRAY(PEEK(1));
+                double index = AS_NUM(PEEK(0));
+                val_t value = VAL_NIL;
+
+                if (index >= 0 && index < array->length && (int)index == index) {
+                    value = VAL_NUM(array->values[(int)index]);
+                }
+
+                POPN(2);
+                PUSH(value);
+            }
+            else if (IS_STRING(PEEK(1)) && IS_NUM(PEEK(0))) {
+                STORE_FRAME();
+                if (IS_ROPE(PEEK(1))) str_flatten(vm, &PEEK(1));
+
+                val_t value = charAt(vm, AS_OBJ(PEEK(1)), AS_INT(PEEK(0)));
+                POPN(2);
+                PUSH(value);
+            }
             else {
                 ERROR("Operands must be a map.");
             }
@@ -638,32 +780,61 @@ int vm_execute(vm_t *vm)
         }
 
         CODE(SETI) {
+            STORE_FRAME();
+            if (NEEDS_KEY(PEEK(1))) str_key(vm, &PEEK(1));
+
             if (IS_MAP(PEEK(2))) {
                 if (IS_NUM(PEEK(1))) {
                     map_t *map = AS_MAP(PEEK(2));
-                    uint64_t key = AS_RAW(PEEK(1));
-                    val_t value = POP();
-                    hash_set(&map->hash, key, value);
+                    val_t *slot = map_slot(map, AS_NUM(PEEK(1)));
+                    val_t value = PEEK(0);
 
-                    POP();
-                    POP();
+                    // Filling or clearing a slot goes through map_seti,
+                    // which counts the slots in use.
+                    if (slot != NULL && !IS_NIL(*slot) && !IS_NIL(value))
+                        *slot = value;
+                    else
+                        map_seti(vm, map, AS_NUM(PEEK(1)), value);
+
+                    POPN(3);
                     PUSH(value);
                 }
                 else if (IS_STR(PEEK(1)))
                 {
                     map_t *map = AS_MAP(PEEK(2));
-                    str_t *key = AS_STR(PEEK(1));
-                    val_t value = POP();
-                    tab_set(&map->table, key, value);
+                    val_t value = PEEK(0);
 
-                    POP();
-                    POP();
+                    if (IS_NIL(value))
+                        dict_remove(&map->dict, PEEK(1));
+                    else
+                        dict_set(&map->dict, PEEK(1), value);
+
+                    POPN(3);
                     PUSH(value);
                 }
                 else {
                     ERROR("Operands must be a number or string.");
                 }
             }
+            else if (IS_F64ARRAY(PEEK(2))) {
+                if (!IS_NUM(PEEK(1)) || !IS_NUM(PEEK(0))) {
+                    ERROR("Operands must be numbers.");
+                }
+
+                f64array_t *array = AS_F64ARRAY(PEEK(2));
+                double index = AS_NUM(PEEK(1));
+                if (index < 0 || index >= array->length || (int)index != index) {
+                    ERROR("Index out of range.");
+                }
+
+                val_t value = PEEK(0);
+                array->values[(int)index] = AS_NUM(value);
+                POPN(3);
+                PUSH(value);
+            }
+            else if (IS_PMAP(PEEK(2))) {
+                ERROR("Persistent maps are immutable, use pmap.set.");
+            }
             else {
                 ERROR("Operands must be a map.");
             }
@@ -678,6 +849,81 @@ int vm_execute(vm_t *vm)
     return VM_OK;
 }
 
+static void executeProtected(vm_t *vm, void *data)
+{
+    *(int *)data = execute(vm);
+}
+
+int vm_execute(vm_t *vm)
+{
+    int result = VM_RUNTIME_ERROR;
+
+    if (!vm_protect(vm, executeProtected, &result)) {
+        runtimeError(vm, "Out of memory.");
+        return VM_RUNTIME_ERROR;
+    }
+
+    return result;
+}
+
+// Runs a call to its end from inside a native. The callee and arguments
+// on top of the stack are replaced by the result, or dropped on an error.
+int vm_invoke(vm_t *vm, int argCount)
+{
+    val_t *callee = vm->top - argCount - 1;
+    int enclosing = vm->base;
+    int result = VM_OK;
+
+    vm->base = vm->frameCount;
+
+    if (!vm_call(vm, *callee, argCount)) {
+        vm->top = callee;
+        result = VM_RUNTIME_ERROR;
+    }
+    else if (vm->frameCount > vm->base) {
+        result = vm_execute(vm);
+    }
+
+    vm->base = enclosing;
+    return result;
+}
+
+bool vm_protect(vm_t *vm, pfn_t function, void *data)
+{
+    jmp_buf handler;
+    jmp_buf *enclosing = vm->handler;
+    vm_t *previous = running;
+
+    vm->handler = &handler;
+    running = vm;
+
+    if (setjmp(handler) == 0) {
+        function(vm, data);
+
+        vm->handler = enclosing;
+        running = previous;
+        return true;
+    }
+
+    vm->handler = enclosing;
+    running = previous;
+    return false;
+}
+
+void vm_nomem(gc_t *gc)
+{
+    vm_t *vm = running;
+
+    // Unprotected code, such as loading the libraries, has nowhere to
+    // unwind to and its callers don't expect a NULL.
+    if (vm == NULL || vm->gc != gc || vm->handler == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(VM_RUNTIME_ERROR);
+    }
+
+    longjmp(*vm->handler, 1);
+}
+
 int vm_dofile(vm_t *vm, const char *fname)
 {
     int result = VM_COMPILE_ERROR;
@@ -692,7 +938,9 @@ int vm_dofile(vm_t *vm, const char *fname)
         PUSH(script);
         vm_call(vm, script, 0);
 
-        result = vm_execute(vm);  
+        result = vm_execute(vm);
+        if (result == VM_OK) POP();
+        if (result == VM_HALTED) result = VM_OK;
     }
 
     src_free(source);
@@ -701,10 +949,10 @@ int vm_dofile(vm_t *vm, const char *fname)
 
 void set_global(vm_t *vm, const char *name, val_t value)
 {
+    PUSH(value);
     val_t global = VAL_OBJ(str_copy(vm, name, (int)strlen(name)));
 
     PUSH(global);
-    PUSH(value);
     tab_set(vm->globals, AS_STR(global), value);
     POP();
     POP();
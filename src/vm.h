@@ -1,10 +1,16 @@
 #pragma once
 
+#include <setjmp.h>
+#include <stdatomic.h>
+
 #include "common.h"
 #include "value.h"
 #include "chunk.h"
 #include "gc.h"
 #include "table.h"
+#include "intern.h"
+#include "task.h"
+#include "thread.h"
 
 typedef struct {
     fun_t *function;
@@ -17,10 +23,19 @@ struct _vm {
     val_t stack[STACK_MAX];
     frame_t frames[FRAMES_MAX];
     int frameCount;
+    int base;           // Frames below belong to an enclosing vm_invoke.
 
     gc_t  *gc;
-    tab_t *strings;
+    intern_t *strings;
     tab_t *globals;
+    pool_t *pool;       // Task workers, shared with clones.
+    threads_t *threads; // Threads the script started, shared with clones.
+    tlab_t tlab;        // Allocates for whichever thread runs this VM.
+
+    vm_t *parent;       // The VM this one was cloned from.
+    vm_t *next;         // Next VM sharing the same gc.
+    jmp_buf *handler;   // Where an out of memory error unwinds to.
+    atomic_bool halt;   // Stops the script at its next call, from any thread.
 };
 
 vm_t *vm_create();
@@ -36,3 +51,7 @@ val_t vm_pop(vm_t *vm);
 
 int vm_execute(vm_t *vm);
 bool vm_call(vm_t *vm, val_t callee, int argCount);
+int vm_invoke(vm_t *vm, int argCount);
+
+bool vm_protect(vm_t *vm, pfn_t function, void *data);
+void vm_nomem(gc_t *gc);
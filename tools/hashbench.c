@@ -0,0 +1,180 @@
+// Compare the string hash against the FNV-1a it replaced.
+//
+//   cc -O2 -Isrc -o hashbench tools/hashbench.c src/utils.c
+//   hashbench [count]
+//
+// For a few key sets it prints the hashing throughput, and the mean and
+// longest probe sequence of a table laid out like tab_t: linear probing,
+// index = hash % capacity, doubled from 8 past a load of 0.75.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+
+#define MAX_LOAD    0.75
+#define ROUNDS_MIN  (1 << 24)
+
+typedef uint32_t (* hfn_t)(const void *bytes, size_t size);
+
+typedef struct {
+    char **keys;
+    size_t *sizes;
+    int count;
+    size_t bytes;
+} keys_t;
+
+static uint32_t fnv1a(const void *bytes, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    const uint8_t *bs = (uint8_t *)bytes;
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bs[i];
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+static void addKey(keys_t *set, const char *chars, size_t size)
+{
+    char *key = malloc(size + 1);
+    memcpy(key, chars, size);
+    key[size] = '\0';
+
+    set->keys[set->count] = key;
+    set->sizes[set->count] = size;
+    set->count++;
+    set->bytes += size;
+}
+
+static keys_t makeKeys(const char *kind, int count)
+{
+    keys_t set = { malloc(count * sizeof(char *)), malloc(count * sizeof(size_t)), 0, 0 };
+    char buffer[1100];
+
+    static const char *words[] = {
+        "count", "index", "value", "node", "next", "left", "right", "name",
+        "size", "buffer", "result", "item", "key", "data", "user", "time"
+    };
+
+    for (int i = 0; i < count; i++) {
+        int n;
+
+        if (strcmp(kind, "ident") == 0) {
+            // Short identifiers, as in field names and globals.
+            n = sprintf(buffer, "%s%s%d", words[i % 16], words[(i / 16) % 16], i / 256);
+        }
+        else if (strcmp(kind, "number") == 0) {
+            // Decimal numbers, all sharing a long common prefix.
+            n = sprintf(buffer, "%d", 1000000 + i);
+        }
+        else if (strcmp(kind, "path") == 0) {
+            n = sprintf(buffer, "/usr/share/lox/%s/%s/module_%06d.lox",
+                words[i % 16], words[(i / 7) % 16], i);
+        }
+        else {
+            // Long text differing only in its last bytes.
+            n = 1000;
+            memset(buffer, 'a' + i % 26, n);
+            n += sprintf(buffer + n, "%d", i);
+        }
+
+        addKey(&set, buffer, n);
+    }
+
+    return set;
+}
+
+static void freeKeys(keys_t *set)
+{
+    for (int i = 0; i < set->count; i++) free(set->keys[i]);
+    free(set->keys);
+    free(set->sizes);
+}
+
+static double throughput(keys_t *set, hfn_t hash, double *nsPerKey)
+{
+    int rounds = (int)(ROUNDS_MIN / (set->bytes + 1)) + 1;
+    volatile uint32_t sink = 0;
+
+    clock_t start = clock();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < set->count; i++) {
+            sink ^= hash(set->keys[i], set->sizes[i]);
+        }
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    (void)sink;
+
+    if (seconds <= 0) seconds = 1e-9;
+    *nsPerKey = seconds * 1e9 / ((double)rounds * set->count);
+    return (double)rounds * set->bytes / seconds / (1024 * 1024);
+}
+
+static void probes(keys_t *set, hfn_t hash, double *mean, int *longest)
+{
+    int capacity = 8;
+    while (set->count > capacity * MAX_LOAD) capacity *= 2;
+
+    int *slots = malloc(capacity * sizeof(int));
+    for (int i = 0; i < capacity; i++) slots[i] = -1;
+
+    long total = 0;
+    *longest = 0;
+
+    for (int i = 0; i < set->count; i++) {
+        uint32_t index = hash(set->keys[i], set->sizes[i]) % capacity;
+        int length = 1;
+
+        while (slots[index] != -1) {
+            index = (index + 1) % capacity;
+            length++;
+        }
+
+        slots[index] = i;
+        total += length;
+        if (length > *longest) *longest = length;
+    }
+
+    *mean = (double)total / set->count;
+    free(slots);
+}
+
+int main(int argc, char **argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+    static const char *kinds[] = { "ident", "number", "path", "text" };
+
+    struct { const char *name; hfn_t fn; } hashes[] = {
+        { "fnv1a", fnv1a },
+        { "wyhash", hash_bytes },
+    };
+
+    hash_seed(0);
+
+    printf("%-8s %-8s %10s %10s %10s %8s\n",
+        "keys", "hash", "MB/s", "ns/key", "probes", "longest");
+
+    for (int k = 0; k < 4; k++) {
+        keys_t set = makeKeys(kinds[k], count);
+
+        for (int h = 0; h < 2; h++) {
+            double ns, mean;
+            int longest;
+
+            double mbs = throughput(&set, hashes[h].fn, &ns);
+            probes(&set, hashes[h].fn, &mean, &longest);
+
+            printf("%-8s %-8s %10.1f %10.2f %10.2f %8d\n",
+                kinds[k], hashes[h].name, mbs, ns, mean, longest);
+        }
+
+        freeKeys(&set);
+    }
+
+    return 0;
+}
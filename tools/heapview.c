@@ -0,0 +1,378 @@
+// Summarize a heap snapshot written by gc.snapshot(path).
+//
+//   cc -O2 -o heapview tools/heapview.c
+//   heapview [-n count] file.heap
+//
+// Prints the heap size per type and the objects retaining the most
+// memory, found from the dominator tree of the object graph, along
+// with the chain of objects that keep each of them alive.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LINE_MAX_   256
+#define TYPES_MAX   16
+#define PATH_MAX_   6
+#define UNDEFINED   -1
+
+typedef struct {
+    uint64_t addr;
+    size_t size;
+    size_t retained;
+    int type;
+    char *label;
+    char *via;          // Label of the reference which first reached it.
+} node_t;
+
+typedef struct {
+    uint64_t from;
+    uint64_t to;
+    char *label;
+} edge_t;
+
+static node_t *nodes;
+static int nodeCount, nodeCapacity;
+
+static edge_t *edges;
+static int edgeCount, edgeCapacity;
+
+static char *types[TYPES_MAX];
+static int typeCount;
+
+static int *slots;      // Open addressing, address -> node index.
+static int slotMask;
+
+static void *grow(void *array, int *capacity, size_t size)
+{
+    *capacity = *capacity < 8 ? 8 : *capacity * 2;
+    array = realloc(array, *capacity * size);
+
+    if (array == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+
+    return array;
+}
+
+static char *copyLabel(const char *s)
+{
+    if (s == NULL || *s == '\0') return NULL;
+
+    size_t length = strcspn(s, "\r\n");
+    char *label = malloc(length + 1);
+    memcpy(label, s, length);
+    label[length] = '\0';
+    return label;
+}
+
+static int internType(const char *name)
+{
+    for (int i = 0; i < typeCount; i++) {
+        if (strcmp(types[i], name) == 0) return i;
+    }
+
+    if (typeCount == TYPES_MAX) return 0;
+    types[typeCount] = copyLabel(name);
+    return typeCount++;
+}
+
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static int *findSlot(uint64_t addr)
+{
+    int i = (int)(mix(addr) & slotMask);
+
+    while (slots[i] != UNDEFINED && nodes[slots[i]].addr != addr) {
+        i = (i + 1) & slotMask;
+    }
+
+    return &slots[i];
+}
+
+static void indexNodes()
+{
+    int capacity = 8;
+    while (capacity < nodeCount * 2) capacity *= 2;
+
+    slots = malloc(capacity * sizeof(int));
+    slotMask = capacity - 1;
+    for (int i = 0; i < capacity; i++) slots[i] = UNDEFINED;
+
+    for (int i = 0; i < nodeCount; i++) {
+        *findSlot(nodes[i].addr) = i;
+    }
+}
+
+static int lookup(uint64_t addr)
+{
+    return *findSlot(addr);
+}
+
+static uint64_t parseId(const char *s)
+{
+    if (strcmp(s, "root") == 0) return 0;
+    return strtoull(s, NULL, 16);
+}
+
+static void readSnapshot(FILE *file)
+{
+    char line[LINE_MAX_];
+
+    if (fgets(line, sizeof(line), file) == NULL ||
+        strncmp(line, "lox-heap 1", 10) != 0) {
+        fprintf(stderr, "Not a heap snapshot.\n");
+        exit(1);
+    }
+
+    // The root set is node 0.
+    nodes = grow(NULL, &nodeCapacity, sizeof(node_t));
+    nodes[nodeCount++] = (node_t){ .addr = 0, .type = internType("root") };
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char a[32], b[32];
+        int offset = 0;
+
+        if (line[0] == 'n') {
+            size_t size = 0;
+            if (sscanf(line, "n %31s %31s %zu %n", a, b, &size, &offset) < 3) continue;
+
+            if (nodeCount >= nodeCapacity)
+                nodes = grow(nodes, &nodeCapacity, sizeof(node_t));
+
+            node_t *node = &nodes[nodeCount++];
+            node->addr = parseId(a);
+            node->size = size;
+            node->retained = 0;
+            node->type = internType(b);
+            node->label = offset > 0 ? copyLabel(line + offset) : NULL;
+            node->via = NULL;
+        }
+        else if (line[0] == 'e') {
+            if (sscanf(line, "e %31s %31s %n", a, b, &offset) < 2) continue;
+
+            if (edgeCount >= edgeCapacity)
+                edges = grow(edges, &edgeCapacity, sizeof(edge_t));
+
+            edge_t *edge = &edges[edgeCount++];
+            edge->from = parseId(a);
+            edge->to = parseId(b);
+            edge->label = offset > 0 ? copyLabel(line + offset) : NULL;
+        }
+
+    }
+}
+
+// Adjacency in compressed rows: the targets of node i are
+// list[first[i] .. first[i + 1]).
+typedef struct {
+    int *first;
+    int *list;
+    int *edge;
+} adj_t;
+
+static void buildAdjacency(adj_t *adj, const int *from, const int *to)
+{
+    adj->first = calloc(nodeCount + 1, sizeof(int));
+    adj->list = malloc((edgeCount + 1) * sizeof(int));
+    adj->edge = malloc((edgeCount + 1) * sizeof(int));
+
+    for (int i = 0; i < edgeCount; i++) {
+        if (from[i] != UNDEFINED && to[i] != UNDEFINED) adj->first[from[i] + 1]++;
+    }
+
+    for (int i = 0; i < nodeCount; i++) {
+        adj->first[i + 1] += adj->first[i];
+    }
+
+    int *fill = malloc(nodeCount * sizeof(int));
+    memcpy(fill, adj->first, nodeCount * sizeof(int));
+
+    for (int i = 0; i < edgeCount; i++) {
+        if (from[i] == UNDEFINED || to[i] == UNDEFINED) continue;
+        int at = fill[from[i]]++;
+        adj->list[at] = to[i];
+        adj->edge[at] = i;
+    }
+
+    free(fill);
+}
+
+static int intersect(const int *idom, const int *post, int a, int b)
+{
+    while (a != b) {
+        while (post[a] < post[b]) a = idom[a];
+        while (post[b] < post[a]) b = idom[b];
+    }
+
+    return a;
+}
+
+static const char *nameOf(node_t *node)
+{
+    if (node->via != NULL) return node->via;
+    if (node->label != NULL) return node->label;
+    return types[node->type];
+}
+
+static int byRetained(const void *a, const void *b)
+{
+    size_t ra = nodes[*(const int *)a].retained;
+    size_t rb = nodes[*(const int *)b].retained;
+    return ra < rb ? 1 : ra > rb ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    int top = 20;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) top = atoi(argv[++i]);
+        else path = argv[i];
+    }
+
+    if (path == NULL) {
+        printf("usage: heapview [-n count] file.heap\n");
+        return 0;
+    }
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        return 1;
+    }
+
+    readSnapshot(file);
+    fclose(file);
+    indexNodes();
+
+    int *from = malloc((edgeCount + 1) * sizeof(int));
+    int *to = malloc((edgeCount + 1) * sizeof(int));
+    for (int i = 0; i < edgeCount; i++) {
+        from[i] = lookup(edges[i].from);
+        to[i] = lookup(edges[i].to);
+    }
+
+    adj_t succ, pred;
+    buildAdjacency(&succ, from, to);
+    buildAdjacency(&pred, to, from);
+
+    // Depth first walk from the root for a reverse postorder.
+    int *post = malloc(nodeCount * sizeof(int));
+    int *order = malloc(nodeCount * sizeof(int));
+    int *stack = malloc(nodeCount * sizeof(int));
+    int *next = malloc(nodeCount * sizeof(int));
+    int visited = 0, sp = 0;
+
+    for (int i = 0; i < nodeCount; i++) post[i] = UNDEFINED;
+    for (int i = 0; i < nodeCount; i++) next[i] = succ.first[i];
+
+    stack[sp++] = 0;
+    post[0] = -2;
+    while (sp > 0) {
+        int v = stack[sp - 1];
+
+        if (next[v] < succ.first[v + 1]) {
+            int at = next[v]++;
+            int w = succ.list[at];
+            if (post[w] != UNDEFINED) continue;
+
+            post[w] = -2;
+            const char *label = edges[succ.edge[at]].label;
+            nodes[w].via = (char *)label;
+            stack[sp++] = w;
+        }
+        else {
+            post[v] = visited;
+            order[visited++] = v;
+            sp--;
+        }
+    }
+
+    // Cooper, Harvey and Kennedy's iterative dominator algorithm.
+    int *idom = malloc(nodeCount * sizeof(int));
+    for (int i = 0; i < nodeCount; i++) idom[i] = UNDEFINED;
+    idom[0] = 0;
+
+    for (bool changed = true; changed; ) {
+        changed = false;
+
+        for (int k = visited - 2; k >= 0; k--) {
+            int v = order[k];
+            int dom = UNDEFINED;
+
+            for (int e = pred.first[v]; e < pred.first[v + 1]; e++) {
+                int p = pred.list[e];
+                if (post[p] < 0 || idom[p] == UNDEFINED) continue;
+                dom = dom == UNDEFINED ? p : intersect(idom, post, p, dom);
+            }
+
+            if (dom != idom[v]) {
+                idom[v] = dom;
+                changed = true;
+            }
+        }
+    }
+
+    size_t total = 0, unreachable = 0;
+    size_t typeBytes[TYPES_MAX] = { 0 };
+    int typeObjects[TYPES_MAX] = { 0 };
+
+    for (int i = 1; i < nodeCount; i++) {
+        total += nodes[i].size;
+        typeBytes[nodes[i].type] += nodes[i].size;
+        typeObjects[nodes[i].type]++;
+        if (post[i] < 0) unreachable += nodes[i].size;
+    }
+
+    // Postorder has every node before its dominator.
+    for (int k = 0; k < visited; k++) {
+        int v = order[k];
+        nodes[v].retained += nodes[v].size;
+        if (v != 0) nodes[idom[v]].retained += nodes[v].retained;
+    }
+
+    printf("heap: %d objects, %d references, %zu bytes, %zu unreachable\n\n",
+        nodeCount - 1, edgeCount, total, unreachable);
+
+    printf("%-8s %10s %12s\n", "type", "objects", "bytes");
+    for (int t = 0; t < typeCount; t++) {
+        if (typeObjects[t] == 0) continue;
+        printf("%-8s %10d %12zu\n", types[t], typeObjects[t], typeBytes[t]);
+    }
+
+    int *ranked = malloc(nodeCount * sizeof(int));
+    int ranks = 0;
+    for (int i = 1; i < nodeCount; i++) {
+        if (post[i] >= 0) ranked[ranks++] = i;
+    }
+    qsort(ranked, ranks, sizeof(int), byRetained);
+
+    printf("\n%12s %10s  %-6s %s\n", "retained", "self", "type", "retainers");
+    for (int k = 0; k < ranks && k < top; k++) {
+        node_t *node = &nodes[ranked[k]];
+        const char *path[PATH_MAX_];
+        int depth = 0;
+
+        for (int v = ranked[k]; v != 0 && depth < PATH_MAX_; v = idom[v]) {
+            path[depth++] = nameOf(&nodes[v]);
+        }
+
+        printf("%12zu %10zu  %-6s root", node->retained, node->size, types[node->type]);
+        if (depth == PATH_MAX_) printf(" > ...");
+        while (depth > 0) printf(" > %s", path[--depth]);
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+// Check that numeric map keys stay O(1) whatever their pattern.
+//
+//   cc -O2 -Isrc -o keybench tools/keybench.c $(ls src/*.c | grep -v main.c) -lm -lpthread
+//   keybench
+//
+// Fills a dict_t with each key set at growing sizes and prints the time
+// per insert and lookup, with the mean and longest number of probes a
+// key takes past its home slot. The same keys are also placed in a simulation of
+// the former scheme, key % capacity without mixing, to show the
+// clustering it had.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vm.h"
+#include "hash.h"
+#include "dict.h"
+
+#define OLD_MAX     (1 << 14)
+#define OLD_LOAD    0.75
+#define OLD_UNUSED  UINT64_MAX
+
+typedef double (* keyfn_t)(int i);
+
+static double smallInts(int i)  { return i; }
+static double strided(int i)    { return (double)i * 1024; }
+static double negative(int i)   { return -i - 1; }
+static double fractions(int i)  { return i / 8.0; }
+static double large(int i)      { return 1e15 + (double)i * 4096; }
+
+static uint64_t keyBits(double key)
+{
+    uint64_t bits;
+    memcpy(&bits, &key, sizeof(bits));
+    return bits;
+}
+
+static double seconds(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static int indexAt(dict_t *dict, uint32_t slot)
+{
+    switch (DICT_WIDTH(dict->capacity)) {
+        case 1: return ((int8_t *)dict->indexes)[slot];
+        case 2: return ((int16_t *)dict->indexes)[slot];
+        default: return ((int32_t *)dict->indexes)[slot];
+    }
+}
+
+// Follows each key's probe sequence, the same as dict.c, to its slot.
+static void probes(dict_t *dict, double *mean, int *longest)
+{
+    uint32_t mask = dict->capacity - 1;
+    long total = 0;
+    *longest = 0;
+
+    for (int i = 0; i < dict->used; i++) {
+        uint32_t hash = dict->entries[i].hash;
+        uint32_t slot = hash & mask;
+        int steps = 0;
+
+        for (uint32_t perturb = hash; indexAt(dict, slot) != i; steps++) {
+            perturb >>= 5;
+            slot = (slot * 5 + perturb + 1) & mask;
+        }
+
+        total += steps;
+        if (steps > *longest) *longest = steps;
+    }
+
+    *mean = dict->count > 0 ? (double)total / dict->count : 0;
+}
+
+// Mean probe length of the old layout, modulo and no mixing.
+static double oldProbes(keyfn_t keys, int count)
+{
+    int capacity = 8;
+    while (count > capacity * OLD_LOAD) capacity *= 2;
+
+    uint64_t *slots = malloc(capacity * sizeof(uint64_t));
+    for (int i = 0; i < capacity; i++) slots[i] = OLD_UNUSED;
+
+    long total = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t key = keyBits(keys(i));
+        uint32_t index = key % capacity;
+
+        while (slots[index] != OLD_UNUSED) {
+            index = (index + 1) % capacity;
+            total++;
+        }
+        slots[index] = key;
+    }
+
+    free(slots);
+    return (double)total / count;
+}
+
+int main()
+{
+    struct { const char *name; keyfn_t fn; } sets[] = {
+        { "ints", smallInts },
+        { "strided", strided },
+        { "negative", negative },
+        { "fraction", fractions },
+        { "large", large },
+    };
+
+    vm_t *vm = vm_create();
+
+    printf("%-9s %8s %9s %9s %8s %8s %10s\n",
+        "keys", "count", "ns/set", "ns/get", "mean", "longest", "old mean");
+
+    for (int s = 0; s < 5; s++) {
+        for (int count = 1 << 10; count <= 1 << 20; count <<= 2) {
+            dict_t dict;
+            dict_init(&dict, vm->gc);
+
+            clock_t start = clock();
+            for (int i = 0; i < count; i++) {
+                dict_set(&dict, VAL_NUM(sets[s].fn(i)), VAL_NUM(i));
+            }
+            double set = seconds(start);
+
+            start = clock();
+            double sum = 0;
+            for (int i = 0; i < count; i++) {
+                val_t value;
+                if (dict_get(&dict, VAL_NUM(sets[s].fn(i)), &value)) sum += AS_NUM(value);
+            }
+            double get = seconds(start);
+
+            double mean;
+            int longest;
+            probes(&dict, &mean, &longest);
+
+            printf("%-9s %8d %9.1f %9.1f %8.2f %8d ", sets[s].name, count,
+                set * 1e9 / count, get * 1e9 / count, mean, longest);
+
+            if (count <= OLD_MAX)
+                printf("%10.1f\n", oldProbes(sets[s].fn, count));
+            else
+                printf("%10s\n", "-");
+
+            if (sum < 0) printf("unreachable\n");
+            dict_free(&dict);
+        }
+    }
+
+    // -0.0 and 0.0 are one key, so are all NaNs.
+    dict_t dict;
+    dict_init(&dict, vm->gc);
+
+    val_t value = VAL_NIL;
+    dict_set(&dict, VAL_NUM(-0.0), VAL_NUM(1));
+    dict_get(&dict, VAL_NUM(0.0), &value);
+    printf("-0.0 == 0.0: %s\n", IS_NUM(value) ? "yes" : "no");
+
+    value = VAL_NIL;
+    dict_set(&dict, (val_t){ .type = VT_NUM, .raw = HASH_NAN | 1 }, VAL_NUM(2));
+    dict_get(&dict, (val_t){ .type = VT_NUM, .raw = HASH_NAN | 12345 }, &value);
+    printf("NaN payloads: %s\n", IS_NUM(value) ? "one key" : "distinct");
+
+    dict_free(&dict);
+    vm_close(vm);
+    return 0;
+}